@@ -1,5 +1,26 @@
 Ch 08/08/05
 Ch mod 05/06/21
+C
+C...User code words, read from the input file after 'CONTINUE'
+C   (HERACLES leaves those lines unread), in the same card format:
+C   'CHECKPOINT'  data: NCKPT, IRESUM
+C      NCKPT  = events between checkpoints, written to
+C               OUTFILENAM_ckpt.dat (0 = no checkpoints);
+C      IRESUM = 1: continue from the last checkpoint.
+C   The continuation is identical to an uninterrupted run only if the
+C   integration is reproducible, i.e. RNDM-SEEDS with ISDINP >= 0;
+C   with date-and-time seeds (ISDINP < 0) IRESUM = 1 is refused.
+C   'DIAGNOSTIC'  data: IDIAG, NEVMOD, NLIST
+C      IDIAG  = 0: summary file OUTFILENAM_diag.dat only at the end;
+C             = 1: summary file rewritten every NEVMOD events (default);
+C             = 2: in addition event characteristics, listing and time
+C                  per event on the output file every NEVMOD events.
+C      NEVMOD = events between summaries (default 100);
+C      NLIST  = full listings on the output file for the first NLIST
+C               events of each failure type, i.e. E-p mismatch > 10 GeV
+C               and each of the NFAILI(1..10) (default 3, 0 = none).
+C   The summary file holds one 'key values' line per quantity, so that
+C   its size does not depend on the number of events.
 C
       SUBROUTINE HSUSER(ICALL,X,Y,Q2)
 C...User analysis routine:
@@ -12,6 +33,7 @@ C...Declarations for heracles
       COMMON /HSOPTN/ INT2(5),INT3(15),ISAM2(5),ISAM3(15),
      *                IOPLOT,IPRINT,ICUT
       COMMON /HSNUME/ SIGTOT,SIGTRR,SIGG(20),SIGGRR(20),NEVENT,NEVE(20)
+      COMMON /HSRDIO/ ISDINP,ISDOUT
       COMMON /HSELAB/ SP,EELE,PELE,EPRO,PPRO
       COMMON /HSCUTS/ XMIN,XMAX,Q2MIN,Q2MAX,YMIN,YMAX,WMIN,GMIN
       COMMON /HSGSW1/ MEI,MEF,MQI,MQF,MEI2,MEF2,MQI2,MQF2,MPRO,MPRO2
@@ -37,18 +59,28 @@ C...Declarations for lepto65
       COMMON/LUDAT1/MSTU(200),PARU(200),MSTJ(200),PARJ(200)
       REAL                    PARU               ,PARJ
       INTEGER MSTU,MSTJ
+C...JETSET random number generator state
+      COMMON/LUDATR/MRLU(6),RRLU(100)
+      INTEGER MRLU
+      REAL RRLU
 C...Number of events from sophia
       COMMON /SPPASS/ NSOPH,NSPOUT,NFAILP,NSPACC
 C
       DIMENSION IFLCNT(-6:6)
       DIMENSION NFAILC(10)
       DIMENSION NMIS(0:12)
+      DIMENSION NLSTC(0:10)
       DIMENSION PSUM(4)
+      DIMENSION ISVEC(25)
+      CHARACTER CKEY*10,CLINE*256
       LOGICAL LFIRST
       DATA LFIRST /.TRUE./
 ctest      DATA NEVMOD/1000/
-      DATA NEVMOD/100/  !print event characteristic in outfile each nevmod
-      SAVE IFLCNT
+      DATA NEVMOD/100/  !diagnostics summary each nevmod events
+      DATA IDIAG/1/, NLIST/3/
+      DATA NCKPT/0/, IRESUM/0/
+      SAVE IFLCNT,NFAILC,NMIS,NLSTC,NEVDON,TIMINI,GSP
+      SAVE TIMTOT,TEVLST,TEVMIN,TEVMAX
 C
       IF(LFIRST) THEN
         LFIRST=.FALSE.
@@ -62,9 +94,16 @@ C
         DO 12 I=0,12
           NMIS(I)=0
  12     CONTINUE
+        DO 14 I=0,10
+          NLSTC(I)=0
+ 14     CONTINUE
         CALL TIMEX(RTIME)
         TIMINI=RTIME
-        N10CNT=0
+        TIMTOT=0D0
+        TEVLST=0D0
+        TEVMIN=0D0
+        TEVMAX=0D0
+        NEVDON=0
         GSP=SP-MPRO2-MEI2
         LUNEVT=NextUn()
 C        OPEN(LUNEVT,FILE=OUTFILENAM(1:ICH)//'_evt.dat',STATUS='NEW')
@@ -76,11 +115,68 @@ C...Initialization of user action
  
  100  CONTINUE
       IF (ICALL.EQ.1) THEN
+
+C...User code words following 'CONTINUE'
+ 101    READ(LUNIN,'(A10)',END=109) CKEY
+        IF (CKEY.EQ.'CHECKPOINT') READ(LUNIN,*,END=109) NCKPT,IRESUM
+        IF (CKEY.EQ.'DIAGNOSTIC') READ(LUNIN,*,END=109) IDIAG,NEVMOD,
+     &                                                  NLIST
+        GOTO 101
+ 109    CONTINUE
+        NEVMOD=MAX(NEVMOD,1)
+
+C...The integration is repeated on restart; seeded from date and time
+C   its grids differ and the continuation would be another sample
+        IF (IRESUM.EQ.1.AND.ISDINP.LT.0) THEN
+          WRITE(LUNOUT,*) ' HSUSER: cannot resume with RNDM-SEEDS',
+     &                    ' ISDINP < 0, the run is not reproducible'
+          STOP
+        ENDIF
+        IF (NCKPT.GT.0.AND.ISDINP.LT.0) WRITE(LUNOUT,*)
+     &    ' HSUSER: RNDM-SEEDS ISDINP < 0, checkpoints cannot be',
+     &    ' resumed'
+
+C...Restart: generator state and counters of the last checkpoint
+        IF (IRESUM.EQ.1) THEN
+          OPEN(32,FILE=OUTFILENAM(1:ICH)//'_ckpt.dat',STATUS='OLD',
+     &         FORM='UNFORMATTED',ERR=108)
+          READ(32) NEVDON,NEVHEP,NTOT,NPASS,NQELAS,NFAILL,NFAILQ,
+     &             NREJCW,NSOPH,NSPOUT,NFAILP,ISVEC,MRLU,RRLU,
+     &             IFLCNT,NFAILC,NMIS,NLSTC
+          CLOSE(32)
+          CALL RLUXIN(ISVEC)
+C...HSUSER(1) comes before the event loop, which takes NEVENT from
+C   /HSNUME/: generate only the events still missing
+          NEVENT=NEVENT-NEVDON
+          WRITE(LUNOUT,1001) NEVDON,NEVENT
+ 1001     FORMAT(/,' HSUSER: resuming after ',I12,' events, ',
+     &           I12,' to go',/)
+        ENDIF
  
 c ---------------------------------------------------------------------
 c     Open ascii output evt file
 c ---------------------------------------------------------------------
 C   EXTENSION='_evt.dat'
+       IF (IRESUM.EQ.1) THEN
+C...Keep the events up to the checkpoint, drop those written after it
+         CALL RENAME(OUTFILENAM(1:ICH)//'_evt.dat',
+     &               OUTFILENAM(1:ICH)//'_evt.old')
+         open(33, file=OUTFILENAM(1:ICH)//'_evt.old',STATUS='OLD')
+         open(31, file=OUTFILENAM(1:ICH)//'_evt.dat',STATUS='UNKNOWN')
+         NFIN=0
+ 102     IF (NFIN.LT.NEVDON) THEN
+           READ(33,'(A)',END=103) CLINE
+           WRITE(31,'(A)') CLINE(1:MAX(1,LEN_TRIM(CLINE)))
+           IF (INDEX(CLINE,'Event finished').GT.0) THEN
+             NFIN=NFIN+1
+             READ(33,'(A)',END=103) CLINE
+             WRITE(31,'(A)') CLINE(1:MAX(1,LEN_TRIM(CLINE)))
+           ENDIF
+           GOTO 102
+         ENDIF
+ 103     CLOSE(33,STATUS='DELETE')
+         RETURN
+       ENDIF
        open(31, file=OUTFILENAM(1:ICH)//'_evt.dat',STATUS='UNKNOWN')
        write(6,*) 'the outputfile will be named: '
      &            ,OUTFILENAM(1:ICH)//'_evt.dat'
@@ -109,6 +205,9 @@ C...Initialize flavor counters
         IFLCNT(I)=0
  13   CONTINUE
       RETURN
+ 108  WRITE(LUNOUT,*) ' HSUSER: no checkpoint ',
+     &                OUTFILENAM(1:ICH)//'_ckpt.dat'
+      STOP
 
  200  CONTINUE
 C-----------------------------------------------------------------------
@@ -134,17 +233,24 @@ C...Count flavors
  20     CONTINUE
       ENDIF
 
-C...Count errors in DJGEVT
+C...Count errors in DJGEVT, list the first NLIST events of each kind
       DO 21 I=1,10
-        IF (NFAILI(I).NE.0) NFAILC(I)=NFAILC(I)+1
+        IF (NFAILI(I).NE.0) THEN
+          NFAILC(I)=NFAILC(I)+1
+          IF (NLSTC(I).LT.NLIST) THEN
+            NLSTC(I)=NLSTC(I)+1
+            WRITE(LUNOUT,2207) I,NLSTC(I),NLIST,NTOT,NEVHEP
+            CALL LULIST(1)
+          ENDIF
+        ENDIF
  21   CONTINUE
 
       IF (IHSONL.EQ.0) THEN
 C...Event characteristics, only after successful hadronization
          IF (LST(21).EQ.0) THEN
 
-C...Print every 'nevmod'th event
-            IF (MOD(NEVHEP,NEVMOD).EQ.0) THEN !print for an event each NEVMOD
+C...Print every 'nevmod'th event (listed below, once edited)
+            IF (IDIAG.GE.2.AND.MOD(NEVHEP,NEVMOD).EQ.0) THEN
               WRITE(LUNOUT,2200) NEVHEP
               WRITE(LUNOUT,2201) ICHNN
               WRITE(LUNOUT,2206) LST(21),MSTU(24),NSPACC
@@ -157,7 +263,6 @@ C...Print every 'nevmod'th event
      &                          ,PHEP(5,2)
               WRITE(LUNOUT,2205) PHEP(1,3),PHEP(2,3),PHEP(3,3),PHEP(4,3)
      &                          ,PHEP(5,3)
-              CALL LULIST(1)
             ENDIF
 
  2200 FORMAT(///,42(' *'),/,' ***** Event No ',I12)
@@ -169,6 +274,8 @@ C...Print every 'nevmod'th event
  2204 FORMAT(' HS q-scat: ',5F12.4)
  2205 FORMAT(' HS ga-rad: ',5F12.4)
  2206 FORMAT(' LST(21) = ',I3,'  MSTU(24) = ',I3,'  NSPACC = ',I3,/)
+ 2207 FORMAT(//,' HSUSER: DJGEVT failure NFAILI(',I2,'), listing ',I3,
+     &       ' of ',I3,'   NTOT = ',I12,'   NEVHEP = ',I12)
  
 C...Remove inactive elements from the event record
             CALL LUEDIT(1)
@@ -198,8 +305,9 @@ C...Check energy-momentum conservation
             PSUML=PSUM(3)-PELE+PPRO
             ESUM=PSUM(4)-EELE-EPRO
             IF ((PSUMT.GT.10D0.OR.ABS(PSUM(3)-PELE+PPRO).GT.10D0
-     &      .OR.ABS(PSUM(4)-EELE-EPRO).GT.10D0).AND.N10CNT.LT.3) THEN
-            N10CNT=N10CNT+1
+     &      .OR.ABS(PSUM(4)-EELE-EPRO).GT.10D0).AND.NLSTC(0).LT.NLIST)
+     &      THEN
+            NLSTC(0)=NLSTC(0)+1
             WRITE(LUNOUT,*) ' '
             WRITE(LUNOUT,*) ' '
             WRITE(LUNOUT,*) ' DJUSER: E-P-mismatch > 10GeV: '
@@ -242,16 +350,24 @@ C...Check energy-momentum conservation
         ENDIF      !143
       ENDIF        !141
  
-C...Print clean event record
+C...Every NEVMOD events: time per event over the interval, summary file
+C   and, on request, the clean event record
       IF(MOD(NEVHEP,NEVMOD).EQ.0) THEN
-        CALL LULIST(1)
-C...Average time per event
         CALL TIMEX(RTIME)
         TIMFIN=RTIME
         RTIME=REAL(TIMFIN-TIMINI)
         TIMINI=TIMFIN
-        TIMEVT=RTIME/NEVMOD
-        WRITE(LUNOUT,2001) NEVHEP,TIMEVT
+        TIMTOT=TIMTOT+RTIME
+        TEVLST=RTIME/NEVMOD
+        IF (TEVMAX.EQ.0D0) TEVMIN=TEVLST
+        TEVMIN=MIN(TEVMIN,TEVLST)
+        TEVMAX=MAX(TEVMAX,TEVLST)
+        IF (IDIAG.GE.2) THEN
+          CALL LULIST(1)
+          WRITE(LUNOUT,2001) NEVHEP,TEVLST
+        ENDIF
+        IF (IDIAG.GE.1) CALL HSDIAG('running',NEVDON,NEVMOD,IFLCNT,
+     &    NFAILC,NMIS,TIMTOT,TEVLST,TEVMIN,TEVMAX)
       ENDIF
 
 C...write events to file
@@ -286,6 +402,25 @@ C     &                    ,V(I,1),V(I,2),V(I,3)
  34      format(6(I10,1x),5(f15.6,1x))
          write(31,*)'=============== Event finished ==============='
          write(31,*) ' '
+         NEVDON=NEVDON+1
+
+C...Checkpoint after this event: flush the output, then write the state
+C   to a temporary file renamed over the previous checkpoint
+      IF (NCKPT.GT.0) THEN
+        IF (MOD(NEVDON,NCKPT).EQ.0) THEN
+          FLUSH(31)
+          FLUSH(LUNOUT)
+          CALL RLUXUT(ISVEC)
+          OPEN(32,FILE=OUTFILENAM(1:ICH)//'_ckpt.tmp',
+     &         STATUS='UNKNOWN',FORM='UNFORMATTED')
+          WRITE(32) NEVDON,NEVHEP,NTOT,NPASS,NQELAS,NFAILL,NFAILQ,
+     &              NREJCW,NSOPH,NSPOUT,NFAILP,ISVEC,MRLU,RRLU,
+     &              IFLCNT,NFAILC,NMIS,NLSTC
+          CLOSE(32)
+          CALL RENAME(OUTFILENAM(1:ICH)//'_ckpt.tmp',
+     &                OUTFILENAM(1:ICH)//'_ckpt.dat')
+        ENDIF
+      ENDIF
 
 C       WRITE(31,2301) ICHNN
 C       WRITE(31,2302) IDHEP(1)
@@ -322,6 +457,10 @@ C...Energy-momentum mismatch
      &                    ,NMIS(5),NMIS(6),NMIS(7),NMIS(8),NMIS(9)
      &                    ,NMIS(10),NMIS(11),NMIS(12)
       ENDIF
+      CALL TIMEX(RTIME)
+      TIMTOT=TIMTOT+REAL(RTIME-TIMINI)
+      CALL HSDIAG('done',NEVDON,NEVMOD,IFLCNT,NFAILC,NMIS,TIMTOT,
+     &  TEVLST,TEVMIN,TEVMAX)
 
       RETURN
  
@@ -364,6 +503,45 @@ C
      F        ,'     E >  2.0: NMIS(11) = ',I8,/
      F        ,'     E > 10.0: NMIS(12) = ',I8,/)
  
+      END
+C
+C%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+C
+      SUBROUTINE HSDIAG(CSTAT,NEVDON,NEVMOD,IFLCNT,NFAILC,NMIS,
+     &                  TIMTOT,TEVLST,TEVMIN,TEVMAX)
+C...Diagnostics summary of HSUSER, OUTFILENAM_diag.dat: one line
+C   'key values' per quantity, rewritten as a whole each time through
+C   a temporary file. Times are CPU seconds from TIMEX; tevt_* are
+C   per event over the intervals of NEVMOD events.
+      IMPLICIT DOUBLE PRECISION (A-H,M,O-Z)
+      CHARACTER*(*) CSTAT
+      DIMENSION IFLCNT(-6:6),NFAILC(10),NMIS(0:12)
+      COMMON /HSNUME/ SIGTOT,SIGTRR,SIGG(20),SIGGRR(20),NEVENT,NEVE(20)
+      COMMON /HSPASS/ NREJCW
+      CHARACTER OUTFILENAM*80
+      COMMON /HSOUTF/ OUTFILENAM,ICH
+      COMMON /DJPASS/ NTOT,NPASS,NQELAS,NFAILL,NFAILQ
+      COMMON /SPPASS/ NSOPH,NSPOUT,NFAILP,NSPACC
+C
+      OPEN(35,FILE=OUTFILENAM(1:ICH)//'_diag.tmp',STATUS='UNKNOWN')
+      WRITE(35,'(A)') '# DJANGOH HSUSER diagnostics'
+      WRITE(35,'(2A)')           'status   ',CSTAT
+      WRITE(35,'(A,1X,I12)')     'nevents ',NEVDON
+      WRITE(35,'(A,1X,I12)')     'nevmod  ',NEVMOD
+      WRITE(35,'(A,5(1X,I12))')  'djpass  ',NTOT,NPASS,NQELAS,NFAILL,
+     &                                      NFAILQ
+      WRITE(35,'(A,1X,I12)')     'nrejcw  ',NREJCW
+      WRITE(35,'(A,3(1X,I12))')  'sppass  ',NSOPH,NSPOUT,NFAILP
+      WRITE(35,'(A,2(1X,E14.6))')'sigtot  ',SIGTOT,SIGTRR
+      WRITE(35,'(A,13(1X,I10))') 'iflcnt  ',(IFLCNT(I),I=-6,6)
+      WRITE(35,'(A,10(1X,I10))') 'nfailc  ',(NFAILC(I),I=1,10)
+      WRITE(35,'(A,12(1X,I10))') 'nmis    ',(NMIS(I),I=1,12)
+      WRITE(35,'(A,1X,E14.6)')   'time    ',TIMTOT
+      WRITE(35,'(A,3(1X,E14.6))')'tevt    ',TEVLST,TEVMIN,TEVMAX
+      CLOSE(35)
+      CALL RENAME(OUTFILENAM(1:ICH)//'_diag.tmp',
+     &            OUTFILENAM(1:ICH)//'_diag.dat')
+      RETURN
       END
 C 
 C%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -7,6 +7,10 @@
 // Running lines:
 // make main777
 // ./main777 main777.cmnd > main777.out
+// ./main777 main777.cmnd --resume >> main777.out  (continue a killed run)
+// ./main777 main777.cmnd --fork 8 > main777.out    (8 worker processes)
+// make main777mpi
+// mpirun -np 8 ./main777mpi main777.cmnd > main777.out   (8 MPI ranks)
 // Simulates the parton shower generated by a hard scattering between an
 // incoming leptonic Abeam and a quark in a nucleonic Bbeam. 
 
@@ -21,6 +25,14 @@
 #include <string>
 #include <stdio.h>
 #include <cmath>
+#include <cstring>
+#include <atomic>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <thread>
+#ifdef MAIN777MPI
+#include <mpi.h>
+#endif
 
 // ROOT functionalities
 #include "TApplication.h"
@@ -57,79 +69,96 @@
 #include "TVirtualPS.h"
 #include "Riostream.h"
 
+// Detector response (vertex, smearing, acceptance)
+#include "main777Detector.h"
+// Stage queues of the pipelined mode
+#include "main777Pipeline.h"
+// Run metadata for merging (main778)
+#include "main777Meta.h"
+// Binned azimuthal moments
+#include "main777Moments.h"
+// Kinematic-bin index of the dis tree
+#include "main777Index.h"
+// Float16_t storage of bounded branches
+#include "main777Float16.h"
+
 
 using namespace Pythia8;
 
 //============================================================================
+// DIS EVENT
+// All quantities written to the dis tree for one event. The tree branches
+// point into one DisEvent; in the pipelined mode the analysis workers fill
+// their own copies, handed over to the writer through the stage queues.
 
-int main( int argc, char* argv[] ){
-
+const Int_t Hmax=50;   //Maximal number of hadrons stored per event
 
+struct DisEvent {
 
-  //==========================================================================
-  //PREPARATION    PREPARATION    PREPARATION    PREPARATION    PREPARATION 
-  //==========================================================================
-  // Save estimates in vectors.
-  vector<double> xsecLO;
-  vector<double> nSelectedLO;
-  vector<double> nAcceptLO;
-  vector<int>    strategyLO;
+  UInt_t Evt;     //  event number
+  double wt;      //  event weight
+  int    TrgMsk;
+  int    SelV;
 
-  static UInt_t   Evt;     //  event number
-  int    TrgMsk = 0 ;
-  int    SelV   = 0 ; 
-  
   //Many Not-A-Number Variables, to be given value afterwards  
-  float  Zprim  = nan("1");   //Coordinates of primary vertex   
-  float  Xprim  = nan("1");   
-  float  Yprim  = nan("1");  
-  float  theta  = nan("1");   //Lepton scattering angle theta
+  float  Zprim;      //Coordinates of primary vertex   
+  float  Xprim;   
+  float  Yprim;  
+  float  theta;      //Lepton scattering angle theta
  
   // Suffixes: _p->4-mom, ph->azimuthal phi, th->polar theta, tr->true values
   // The differnce between true values and reconstructed is that true values
   // take into account possible emissions of photons, as far as possible for
   // PYTHIA 8.306, before the hard scattering process, hence resulting into a 
   //different value of kinematic variables.
-  float  aeam_p   = nan("1");   //Incoming A beam (lab)   
-  float  aeamph   = nan("1");         
-  float  aeamth   = nan("1");
-  float  beam_p   = nan("1");   //Incoming B beam (lab)       
-  float  beamph   = nan("1");         
-  float  beamth   = nan("1");         
-  float  outlep_p = nan("1");   //Outgoing lepton (lab)
-  float  outlepph = nan("1");
-  float  outlepth = nan("1"); 
-  float  gaene    = nan("1");   //Virtual photon (lab)
-  float  gathe    = nan("1");
-  float  gaphi    = nan("1");
-  float  phi_s    = nan("1");   //SPIN phi GNS (Gamma Nucleon System)
-  float  cosvp    = nan("1");
-  float  gathx    = nan("1");   //Lab frame gamma x angle
-  float  gathy    = nan("1");   //lab frame gamma y angle
-  float  bcm      = nan("1");   //Reconstructed Lorentz boost
-  float  gcm      = nan("1");   //Reconstructed Lorentz gamma
-  float  phr_p    = nan("1");
-  float  phrth    = nan("1");
-  float  phrph    = nan("1");
-  float  nu       = nan("1");   //Values of kinematic variables
-  float  Q2       = nan("1");
-  float  xbj      = nan("1");
-  float  y        = nan("1");
-  float  W        = nan("1");
-  float  nutr     = nan("1");   //True Values of kinematic variables
-  float  Q2tr     = nan("1");
-  float  xbjtr    = nan("1");
-  float  ytr      = nan("1");
-  float  Wtr      = nan("1");  
-  float  str      = nan("1");  //Mandelstam s (Total 4P^2) (True Value)
-  float  ttr      = nan("1");  //Mandelstam t (True Value)
-
-  Int_t  HadNb   = 0 ;
-  Int_t  GamNb   = 0 ;
-  Int_t  Pi0Nb   = 0 ;
+  float  aeam_p;     //Incoming A beam (lab)   
+  float  aeamph;         
+  float  aeamth;
+  float  beam_p;     //Incoming B beam (lab)       
+  float  beamph;         
+  float  beamth;         
+  float  outlep_p;   //Outgoing lepton (lab)
+  float  outlepph;
+  float  outlepth; 
+  float  gaene;      //Virtual photon (lab)
+  float  gathe;
+  float  gaphi;
+  float  phi_s;      //SPIN phi GNS (Gamma Nucleon System)
+  float  cosvp;
+  float  gathx;      //Lab frame gamma x angle
+  float  gathy;      //lab frame gamma y angle
+  float  bcm;        //Reconstructed Lorentz boost
+  float  gcm;        //Reconstructed Lorentz gamma
+  float  phr_p;
+  float  phrth;
+  float  phrph;
+  float  nu;         //Values of kinematic variables
+  float  Q2;
+  float  xbj;
+  float  y;
+  float  W;
+  float  nutr;       //True Values of kinematic variables
+  float  Q2tr;
+  float  xbjtr;
+  float  ytr;
+  float  Wtr;  
+  float  str;        //Mandelstam s (Total 4P^2) (True Value)
+  float  ttr;        //Mandelstam t (True Value)
+
+  float  outlep_pdet;   //Outgoing lepton, detector level
+  float  outlepthdet;
+  float  outlepphdet;
+  float  nudet;      //Kinematic variables, detector level
+  float  Q2det;
+  float  xbjdet;
+  float  ydet;
+  float  Wdet;
+
+  Int_t  HadNb;
+  Int_t  GamNb;
+  Int_t  Pi0Nb;
 
   //Hadrons' Shower (note h suffix)
-  const Int_t Hmax=50;
   int    SelH  [Hmax];
   Int_t  ch    [Hmax]; //identity
   float  zh    [Hmax]; //z variable
@@ -141,8 +170,11 @@ int main( int argc, char* argv[] ){
   float  phi_h [Hmax];
   float  theha [Hmax];
   float  phiha [Hmax];
+  float  zhdet    [Hmax]; //detector level z, momentum and angles
+  float  phdet    [Hmax];
+  float  thehadet [Hmax];
+  float  phihadet [Hmax];
 
-  
   //Photons (note g suffix)
   //const Int_t Gmax=50;
   //Int_t  cg    [Gmax];
@@ -153,225 +185,14 @@ int main( int argc, char* argv[] ){
   //float  pzg   [Gmax];
   //float  ptg   [Gmax];
 
- static TTree* tree(NULL);
- TRandom * r1 = new TRandom(1);
- TRandom * r2 = new TRandom(1);
- TRandom * r3 = new TRandom(1);
- 
- 
- //Create the TTree
- tree = new TTree("dis","DIS tree"); // name (has to be unique) and title of the Ntuple
- 
- //Branches (branch name, address for variable to be read, leafname/<type>)
- tree->Branch("Evt"       ,&Evt       ,"Evt/i"          );
- tree->Branch("SelV"      ,&SelV      ,"SelV/i"         );
- tree->Branch("Xprim"     ,&Xprim     ,"Xprim/F"        );
- tree->Branch("Yprim"     ,&Yprim     ,"Yprim/F"        );
- tree->Branch("Zprim"     ,&Zprim     ,"Zprim/F"        );
- tree->Branch("theta"     ,&theta     ,"theta/F"        );
- tree->Branch("beam_p"    ,&beam_p    ,"beam_p/F"       );// incoming B beam
- tree->Branch("beamph"    ,&beamph    ,"beamph/F"       );
- tree->Branch("beamth"    ,&beamth    ,"beamth/F"       );
- tree->Branch("aeam_p"    ,&aeam_p    ,"aeam_p/F"       );// incoming A beam
- tree->Branch("aeamph"    ,&aeamph    ,"aeamph/F"       );
- tree->Branch("aeamth"    ,&aeamth    ,"aeamth/F"       );
- tree->Branch("outlep_p"  ,&outlep_p  ,"aupr_p/F"       );//outgoing mu 	  
- tree->Branch("outlepph"  ,&outlepph  ,"outlepph/F"     );
- tree->Branch("outlepth"  ,&outlepth  ,"outlepth/F"     );
- tree->Branch("gaene"     ,&gaene     ,"gaene/F"        );// virtual photon
- tree->Branch("gaphi"     ,&gaphi     ,"gaphi/F"        );
- tree->Branch("gathe"     ,&gathe     ,"gathe/F"        );
- tree->Branch("phi_s"     ,&phi_s     ,"phi_s/F"        );// SPIN phi  GNS 
- tree->Branch("bcm"       ,&bcm       ,"bcm/F"          );// Lorentz Beta    
- tree->Branch("gcm"       ,&gcm       ,"gcm/F"          );// Lorentz Gamma 
- tree->Branch("nu"        ,&nu        ,"nu/F"           );// nu (GeV)
- tree->Branch("Q2"        ,&Q2        ,"Q2/F"           );// Q2 (GeV/c)^2
- tree->Branch("xbj"       ,&xbj       ,"xbj/F"          );// xbj
- tree->Branch("y"         ,&y         ,"y/F"            );// y
- tree->Branch("W"         ,&W         ,"W/F"            );// W  
- tree->Branch("nutr"      ,&nutr      ,"nutr/F"         );// true nu (GeV)
- tree->Branch("Q2tr"      ,&Q2tr      ,"Q2tr/F"         );// true Q2 (GeV/c)^2
- tree->Branch("xbjtr"     ,&xbjtr     ,"xbjtr/F"        );// true xbj
- tree->Branch("ytr"       ,&ytr       ,"ytr/F"          );// true y
- tree->Branch("Wtr"       ,&Wtr       ,"Wtr/F"          );// true W 
- tree->Branch("str"       ,&str       ,"str/F"          );// Mandelstam s(true)
- tree->Branch("ttr"       ,&ttr       ,"ttr/F"          );// Mandelstam t(true)
- tree->Branch("cosvp"     ,&cosvp     ,"cosvp/F"        );
- tree->Branch("gathx"     ,&gathx     ,"gathx/F"        );
- tree->Branch("gathy"     ,&gathy     ,"gathy/F"        );
- tree->Branch("phr_p"     ,&phr_p     ,"phr_p/F"	  );
- tree->Branch("phrth"     ,&phrth     ,"phrth/F"        );
- tree->Branch("phrph"     ,&phrph     ,"phrph/F"        );
-  
- // hadrons (0<i<HadNb)				       
- tree->Branch("HadNb"   ,&HadNb   ,"HadNb/I"        );// Tot number of hadrons
- tree->Branch("SelH"    , SelH    ,"SelH[HadNb]/I"  );
- tree->Branch("ch"      , ch      ,"ch[HadNb]/I"    );// hadron i jetset ID
- tree->Branch("zh"      , zh      ,"zh[HadNb]/F"    );// hadron i z
- tree->Branch("eh"      , eh      ,"eh[HadNb]/F"    );// hadron i Lab energy
- tree->Branch("ph"      , ph      ,"ph[HadNb]/F"    );// hadron i Lab momentum
- tree->Branch("theha"   , theha   ,"theha[HadNb]/F" );// hadron i polar theta
- tree->Branch("phiha"   , phiha   ,"phiha[HadNb]/F" );// hadron i azimut phi
- //tree->Branch("xfh"     , xfh     ,"xfh[HadNb]/F"   );// hadron i x_Feynmann  
- tree->Branch("etah"    , etah    ,"etah[HadNb]/F"  );// hadron i pseudo-rapidity
- tree->Branch("pth"     , pth     ,"pth[HadNb]/F"   );// hadron i GNS P_hT
- tree->Branch("phi_h"   , phi_h   ,"phi_h[HadNb]/F" );// hadron i GNS azimut phi
- 
- // photons					       
- //tree->Branch("GamNb"   ,&GamNb   ,"GamNb/I"        );
- //tree->Branch("cg"      , cg      ,"cg[GamNb]/I"    );
- //tree->Branch("zg"      , zg      ,"zg[GamNb]/F"    );
- //tree->Branch("eg"      , eg      ,"eg[GamNb]/F"    );
- //tree->Branch("pxg"     , pxg     ,"pxg[GamNb]/F"   );
- //tree->Branch("pyg"     , pyg     ,"pyg[GamNb]/F"   );
- //tree->Branch("pzg"     , pzg     ,"pzg[GamNb]/F"   );
- //tree->Branch("ptg"     , ptg     ,"ptg[GamNb]/F"   );
- 
- 
- //Doubles, 4Vecs and 3Vecs for later analysis
- 
- TLorentzVector lvh     (0,0,0,0);
- TLorentzVector hrd_p   (0,0,0,0);
- TLorentzVector l_esse  (0,0,0,0);
- TLorentzVector l_nuc_i  (0,0,0,0);      //4p of proton
- TLorentzVector l_MM    (0,0,0,0);      
- TLorentzVector l_lep_i  (0,0,0,0);      //4p of incoming lepton 
- TLorentzVector l_lep_f  (0,0,0,0);      //4p of outcoming lepton
- TLorentzVector p_cms   (0,0,0,0);
- TLorentzVector Gamma   (0.,0.,0.,0.);  //4p of virtual photon
- TLorentzVector Gammatr (0.,0.,0.,0.);  //true 4p of virtual photon
- TLorentzVector dummyl_ (0.,0.,0.,0.);
- TLorentzVector lSpin   (0.,1.,0.,0.);
- 
- TVector3 p1,p2     ;
- TVector3 iv(1.,0.,0.); //Basis Vectors
- TVector3 jv(0.,1.,0.);
- TVector3 kv(0.,0.,1.);
- 
- Double_t boostGNS      ,boostGNStr   ; 
- Double_t sinphis_GNS   ,cosphis_GNS  ;
- Double_t sinphihp_GNS  ,cosphihp_GNS ;
- Double_t sinphih_GNS   ,cosphih_GNS  , sinphih_GNS2;
- 
- TVector3 xx   ,yy   ,zz   ,xxtr   ,yytr   ,zztr;
- TVector3 xxl  ,yyl  ,zzl  ;
- TVector3 xxGNS,yyGNS,zzGNS,xxGNStr,yyGNStr,zzGNStr;
- TVector3 BoostGNS, BoostGNStr;
- TVector3 SB,SBtr,HB,HBtr,HP;
- TRotation GNS, GNStr;
- TLorentzVector GammaGNS, l_lep_iGNS, l_lep_fGNS, l_nuc_iGNS, GammaGNStr, l_lep_iGNStr, l_lep_fGNStr;
- TLorentzVector lSpinGNS, lSpinGNStr;
- TLorentzVector v_fot,i_lep,f_lep,v_fottr,i_leptr,f_leptr,hrd_pGNS,f_had,f_hadtr;
- TLorentzVector lvhGNS,lvhGNStr,lvhrealGNS,lvhrealGNStr;
- 
- 
- 
-  //=========================================================================
-  //INITIALIZATION    INITIALIZATION    INITIALIZATION    INITIALIZATION  ===   
-  //=========================================================================
-  
-  Pythia pythia;
-  pythia.readFile  (argv[1]);
-  
-  int nEvent = pythia.mode("Main:numberOfEvents");
-
-
-
-  //=========================================================================
-  // CROSS SECTION ESTIMATE RUN =============================================
-  //=========================================================================
-  
-  //Switch OFF all showering and MPI when estimating the cross section, 
-  //then re-initialise (unfortunately).
-  bool fsr = pythia.flag("PartonLevel:FSR");
-  bool isr = pythia.flag("PartonLevel:ISR");
-  bool mpi = pythia.flag("PartonLevel:MPI");
-  bool had = pythia.flag("HadronLevel:all");
-  bool rem = pythia.flag("PartonLevel:Remnants");
-  bool chk = pythia.flag("Check:Event");
-  int nCount = pythia.settings.mode("Next:numberCount");
-  pythia.settings.flag("PartonLevel:FSR",     false);
-  pythia.settings.flag("PartonLevel:ISR",     false);
-  pythia.settings.flag("PartonLevel:MPI",     false);
-  pythia.settings.flag("HadronLevel:all",     false);
-  pythia.settings.flag("PartonLevel:Remnants",false);
-  pythia.settings.flag("Check:Event",         false);
-  pythia.settings.mode("Next:numberCount",nEvent);
-  pythia.init();
-  
-  double sumSH     = 0.;
-  double nAcceptSH = 0.;
-  
-  for( int iEvent=0; iEvent<nEvent; ++iEvent ){
-    
-    if( !pythia.next() ) {
-      if( pythia.info.atEndOfFile() )
-        break;
-      else continue;
-      }
-
-    sumSH     += pythia.info.weight();
-    
-    //Build a map from a certain string to a certain other string
-    map <string,string> eventAttributes;
-    //pythia.info.eventAttributes is a pointer to a <string,string> map 
-    //and public attribute of pythia::info
-    if (pythia.info.eventAttributes) {
-      eventAttributes = *(pythia.info.eventAttributes); //retrieve the map
-      string trials = (eventAttributes.find("trials") != eventAttributes.end())
-                      ?  eventAttributes["trials"] : "";
-      if (trials != "") {nAcceptSH += atof (trials.c_str()) ;}
-     
-     xsecLO.push_back(pythia.info.sigmaGen(iEvent));
-     nAcceptLO.push_back(pythia.info.nAccepted(iEvent));
-    }
-  }
-  
-  pythia.stat();
-
-  int nAccept   = pythia.info.nAccepted(); //accepted events by pythia and user
-  double xs     = pythia.info.sigmaGen();  //estimated cross section
-  
-
-  
-  //===========================================================================
-  // EVENT GENERATION LOOP=====================================================
-  //===========================================================================
-   
-  pythia.settings.mode("Next:numberCount", nCount);
-
-  // Cross section and error.
-  double sigmaTotal  = 0.;
-  double errorTotal  = 0.;
-
-  double sigmaSample = 0., errorSample = 0.;
-  
-  // Switch showering and multiple interaction back to original setting.
-  pythia.settings.flag("PartonLevel:FSR",fsr);
-  pythia.settings.flag("PartonLevel:ISR",isr);
-  pythia.settings.flag("HadronLevel:all",had);
-  pythia.settings.flag("PartonLevel:MPI",mpi);
-  pythia.settings.flag("PartonLevel:Remnants",rem);
-  pythia.settings.flag("Check:Event",chk);
-  pythia.init();
-
-  double wmax    =-1e15; 
-  double wmin    = 1e15;
-  double sumwt   = 0.;
-  double sumwtsq = 0.;
-  double wtcount = 0.;
-  
-  // Root-Histogram the weights
-  TH1F *histWT = new TH1F("histWT", "Weights", 5000000, -1000., 1000.);
-  
-  for( int iEvent=0; iEvent<nEvent; ++iEvent ){
-  
   //Set to NAN before every event
+  void reset() {
     TrgMsk = 0 ;
     SelV   = 0 ;        
     Zprim  = nan("1");     
     Xprim  = nan("1");     
     Yprim  = nan("1");     
+    theta  = nan("1");
     
     aeam_p = nan("1");         
     aeamph = nan("1");         
@@ -396,12 +217,28 @@ int main( int argc, char* argv[] ){
     xbj    = nan("1");
     y      = nan("1");
     W      = nan("1");
+    nutr   = nan("1");
+    Q2tr   = nan("1");
+    xbjtr  = nan("1");
+    ytr    = nan("1");
+    Wtr    = nan("1");
+    str    = nan("1");
+    ttr    = nan("1");
     phr_p  = nan("1");
     phrth  = nan("1");
     phrph  = nan("1");
+    outlep_pdet = nan("1");
+    outlepthdet = nan("1");
+    outlepphdet = nan("1");
+    nudet  = nan("1");
+    Q2det  = nan("1");
+    xbjdet = nan("1");
+    ydet   = nan("1");
+    Wdet   = nan("1");
    
     HadNb   = 0 ;
     GamNb   = 0 ;
+    Pi0Nb   = 0 ;
     
     for (int ik=0;ik<Hmax;ik++) {
       SelH   [ik] = 0;
@@ -415,6 +252,10 @@ int main( int argc, char* argv[] ){
       phi_h  [ik] = nanf("1");
       theha  [ik] = nanf("1");
       phiha  [ik] = nanf("1");
+      zhdet    [ik] = nanf("1");
+      phdet    [ik] = nanf("1");
+      thehadet [ik] = nanf("1");
+      phihadet [ik] = nanf("1");
     }
     
     //for (int ik=0;ik<Gmax;ik++) {
@@ -426,125 +267,276 @@ int main( int argc, char* argv[] ){
     //  pzg    [ik] = nanf("1");
     //  ptg    [ik] = nanf("1");
     //}
+  }
 
+};
 
-    if( !pythia.next() ) {
-      if( pythia.info.atEndOfFile() )
-        break;
-      else continue;
-    }
-    
-    //-----------------------------------------------------------------------
-    //WEIGHTS ---------------------------------------------------------------
-    //-----------------------------------------------------------------------
-    // Get event weight(s).
-    double evtweight         = pythia.info.weight();
+// Point the dis tree branches at ev. On resume the branches exist already,
+// only their addresses are needed. Without hadrons only their number is
+// kept (see Main777:hadronBranches). Float branches with a spec in f16 are
+// written as Float16_t, and watched by f16 for the quantization errors;
+// left-out ones are still known to f16 as float branches.
+void bookBranches(TTree* tree, DisEvent& ev, bool resume, bool hadrons,
+  Float16Report* f16 = 0){
 
-    if (abs(evtweight) > 1e3) {
-      cout << scientific << setprecision(8)
-      << "Warning: Large shower weight wt = " << evtweight << endl;
-      if (abs(evtweight) > 1e4) { 
-        cout << "Warning: Shower weight larger than 10000."
-        << "Discard event with rare shower weight fluctuation."
-        << endl;
-        evtweight = 0.;
-      }
-    }   
-    // Do not print zero-weight events.
-    if ( evtweight == 0. ) continue;
+ bool skip = false;
+ auto Branch = [&](const char* name, void* address, const char* leaves) {
+   string leaf = leaves;
+   const Float16Spec* spec = f16 ? f16->find(name) : 0;
+   if (spec && leaf.size() > 2 && leaf.substr(leaf.size() - 2) == "/F") {
+     f16->book(spec);
+     if (skip) return;
+     leaf = leaf.substr(0, leaf.size() - 1) + "f" + spec->leafRange();
+     bool array = leaf.find("[HadNb]") != string::npos;
+     f16->watch(spec, (const float*) address, array ? &ev.HadNb : 0);
+   }
+   if (skip) return;
+   if (resume) tree->SetBranchAddress(name, address);
+   else        tree->Branch(name, address, leaf.c_str());
+ };
 
-    wmin     = min(wmin, evtweight);
-    wmax     = max(wmax, evtweight);
-    sumwt   += evtweight;
-    sumwtsq += pow2(evtweight);
-    wtcount += 1.;
-    histWT -> Fill (evtweight);
-    
-    double normhepmc = xsecLO[iEvent] / nAcceptLO[iEvent];
-    // Weighted events with additional number of trial events to consider.
-    if ( pythia.info.lhaStrategy() != 0
-      && pythia.info.lhaStrategy() != 3
-      && nAcceptSH > 0)
-      normhepmc = 1. / (1e9*nAcceptSH);
-    // Weighted events.
-    else if ( pythia.info.lhaStrategy() != 0
-      && pythia.info.lhaStrategy() != 3
-      && nAcceptSH == 0)
-      normhepmc = 1. / (1e9*nAccept);
+ //Branches (branch name, address for variable to be read, leafname/<type>)
+ Branch("Evt"       ,&ev.Evt       ,"Evt/i"          );
+ Branch("wt"        ,&ev.wt        ,"wt/D"           );// event weight
+ Branch("SelV"      ,&ev.SelV      ,"SelV/i"         );// lepton accepted
+ Branch("Xprim"     ,&ev.Xprim     ,"Xprim/F"        );
+ Branch("Yprim"     ,&ev.Yprim     ,"Yprim/F"        );
+ Branch("Zprim"     ,&ev.Zprim     ,"Zprim/F"        );
+ Branch("theta"     ,&ev.theta     ,"theta/F"        );
+ Branch("beam_p"    ,&ev.beam_p    ,"beam_p/F"       );// incoming B beam
+ Branch("beamph"    ,&ev.beamph    ,"beamph/F"       );
+ Branch("beamth"    ,&ev.beamth    ,"beamth/F"       );
+ Branch("aeam_p"    ,&ev.aeam_p    ,"aeam_p/F"       );// incoming A beam
+ Branch("aeamph"    ,&ev.aeamph    ,"aeamph/F"       );
+ Branch("aeamth"    ,&ev.aeamth    ,"aeamth/F"       );
+ Branch("outlep_p"  ,&ev.outlep_p  ,"aupr_p/F"       );//outgoing mu 	  
+ Branch("outlepph"  ,&ev.outlepph  ,"outlepph/F"     );
+ Branch("outlepth"  ,&ev.outlepth  ,"outlepth/F"     );
+ Branch("gaene"     ,&ev.gaene     ,"gaene/F"        );// virtual photon
+ Branch("gaphi"     ,&ev.gaphi     ,"gaphi/F"        );
+ Branch("gathe"     ,&ev.gathe     ,"gathe/F"        );
+ Branch("phi_s"     ,&ev.phi_s     ,"phi_s/F"        );// SPIN phi  GNS 
+ Branch("bcm"       ,&ev.bcm       ,"bcm/F"          );// Lorentz Beta    
+ Branch("gcm"       ,&ev.gcm       ,"gcm/F"          );// Lorentz Gamma 
+ Branch("nu"        ,&ev.nu        ,"nu/F"           );// nu (GeV)
+ Branch("Q2"        ,&ev.Q2        ,"Q2/F"           );// Q2 (GeV/c)^2
+ Branch("xbj"       ,&ev.xbj       ,"xbj/F"          );// xbj
+ Branch("y"         ,&ev.y         ,"y/F"            );// y
+ Branch("W"         ,&ev.W         ,"W/F"            );// W  
+ Branch("nutr"      ,&ev.nutr      ,"nutr/F"         );// true nu (GeV)
+ Branch("Q2tr"      ,&ev.Q2tr      ,"Q2tr/F"         );// true Q2 (GeV/c)^2
+ Branch("xbjtr"     ,&ev.xbjtr     ,"xbjtr/F"        );// true xbj
+ Branch("ytr"       ,&ev.ytr       ,"ytr/F"          );// true y
+ Branch("Wtr"       ,&ev.Wtr       ,"Wtr/F"          );// true W 
+ Branch("str"       ,&ev.str       ,"str/F"          );// Mandelstam s(true)
+ Branch("ttr"       ,&ev.ttr       ,"ttr/F"          );// Mandelstam t(true)
+ Branch("cosvp"     ,&ev.cosvp     ,"cosvp/F"        );
+ Branch("gathx"     ,&ev.gathx     ,"gathx/F"        );
+ Branch("gathy"     ,&ev.gathy     ,"gathy/F"        );
+ Branch("phr_p"     ,&ev.phr_p     ,"phr_p/F"	  );
+ Branch("phrth"     ,&ev.phrth     ,"phrth/F"        );
+ Branch("phrph"     ,&ev.phrph     ,"phrph/F"        );
+ Branch("outlep_pdet",&ev.outlep_pdet,"outlep_pdet/F"  );// detector level mu
+ Branch("outlepthdet",&ev.outlepthdet,"outlepthdet/F"  );
+ Branch("outlepphdet",&ev.outlepphdet,"outlepphdet/F"  );
+ Branch("nudet"     ,&ev.nudet     ,"nudet/F"        );// detector level nu
+ Branch("Q2det"     ,&ev.Q2det     ,"Q2det/F"        );// detector level Q2
+ Branch("xbjdet"    ,&ev.xbjdet    ,"xbjdet/F"       );// detector level xbj
+ Branch("ydet"      ,&ev.ydet      ,"ydet/F"         );// detector level y
+ Branch("Wdet"      ,&ev.Wdet      ,"Wdet/F"         );// detector level W
+  
+ // hadrons (0<i<HadNb)				       
+ Branch("HadNb"   ,&ev.HadNb   ,"HadNb/I"        );// Tot number of hadrons
+ skip = !hadrons;
+ Branch("SelH"    , ev.SelH    ,"SelH[HadNb]/I"  );// hadron i accepted
+ Branch("ch"      , ev.ch      ,"ch[HadNb]/I"    );// hadron i jetset ID
+ Branch("zh"      , ev.zh      ,"zh[HadNb]/F"    );// hadron i z
+ Branch("eh"      , ev.eh      ,"eh[HadNb]/F"    );// hadron i Lab energy
+ Branch("ph"      , ev.ph      ,"ph[HadNb]/F"    );// hadron i Lab momentum
+ Branch("theha"   , ev.theha   ,"theha[HadNb]/F" );// hadron i polar theta
+ Branch("phiha"   , ev.phiha   ,"phiha[HadNb]/F" );// hadron i azimut phi
+ //tree->Branch("xfh"     , xfh     ,"xfh[HadNb]/F"   );// hadron i x_Feynmann  
+ Branch("etah"    , ev.etah    ,"etah[HadNb]/F"  );// hadron i pseudo-rapidity
+ Branch("pth"     , ev.pth     ,"pth[HadNb]/F"   );// hadron i GNS P_hT
+ Branch("phi_h"   , ev.phi_h   ,"phi_h[HadNb]/F" );// hadron i GNS azimut phi
+ Branch("zhdet"   , ev.zhdet   ,"zhdet[HadNb]/F"   );// detector level z
+ Branch("phdet"   , ev.phdet   ,"phdet[HadNb]/F"   );// detector level momentum
+ Branch("thehadet", ev.thehadet,"thehadet[HadNb]/F");// detector level theta
+ Branch("phihadet", ev.phihadet,"phihadet[HadNb]/F");// detector level phi
+ 
+ // photons					       
+ //tree->Branch("GamNb"   ,&GamNb   ,"GamNb/I"        );
+ //tree->Branch("cg"      , cg      ,"cg[GamNb]/I"    );
+ //tree->Branch("zg"      , zg      ,"zg[GamNb]/F"    );
+ //tree->Branch("eg"      , eg      ,"eg[GamNb]/F"    );
+ //tree->Branch("pxg"     , pxg     ,"pxg[GamNb]/F"   );
+ //tree->Branch("pyg"     , pyg     ,"pyg[GamNb]/F"   );
+ //tree->Branch("pzg"     , pzg     ,"pzg[GamNb]/F"   );
+ //tree->Branch("ptg"     , ptg     ,"ptg[GamNb]/F"   );
+}
 
-    
-    //------------------------------------------------------------------------
-    //KINEMATIC ANALYSIS------------------------------------------------------
-    //------------------------------------------------------------------------    
-    if(pythia.event.size() > 3){
+//============================================================================
+// EVENT RECORD
+// What the analysis needs from a Pythia event: the beam and hard-scattering
+// leptons, the nucleon and the charged final-state particles, in a fixed
+// size record that can be copied into a stage queue without allocation.
 
-      sigmaTotal  += evtweight * normhepmc;
-      sigmaSample += evtweight * normhepmc;
-      errorTotal  += pow2(evtweight * normhepmc);
-      errorSample += pow2(evtweight * normhepmc);       
+struct HadronRecord {
+  int   id;
+  Vec4  p;                          // in double, as Pythia has it
+};
+
+struct EventRecord {
+  UInt_t iEvent;
+  double weight;
+  bool   valid;                     // more than the two beams in the event
+  bool   muon;                      // beam lepton is a muon
+  Vec4   p0Lept, pInLept, pScatLept, pNucleon;
+  double sHat, tHat;
+  int    nHad;
+  HadronRecord had[Hmax];
+};
+
+// Copy the current Pythia event into rec (generator side).
+void fillRecord(Pythia& pythia, UInt_t iEvent, double weight,
+  EventRecord& rec){
+
+  rec.iEvent = iEvent;
+  rec.weight = weight;
+  rec.valid  = pythia.event.size() > 3;
+  rec.nHad   = 0;
+  if (!rec.valid) return;
+
+  int iNucleon = pythia.event[1].isHadron() ? 1 : 2;
+  int iLepton  = iNucleon == 1 ? 2 : 1;             
       
-      int iNucleon = pythia.event[1].isHadron() ? 1 : 2;
-      int iLepton  = iNucleon == 1 ? 2 : 1;             
+  int iInLepton(0), iScatLepton(0);
+  for ( int i=0; i < pythia.event.size(); ++i ) {
+    if(pythia.event[i].statusAbs()==21 && pythia.event[i].isAncestor(iLepton))
+    iInLepton = i;
+    else if(pythia.event[i].statusAbs()==23 && pythia.event[i].id()==pythia.event[iLepton].id())
+    iScatLepton = i;
+  }
+
+  rec.muon      = pythia.event[iLepton].idAbs() == 13;
+  rec.p0Lept    = pythia.event[iLepton]    .p();
+  rec.pInLept   = pythia.event[iInLepton]  .p();
+  rec.pScatLept = pythia.event[iScatLepton].p();
+  rec.pNucleon  = pythia.event[iNucleon]   .p();
+  rec.sHat      = pythia.info.sHat();
+  rec.tHat      = pythia.info.tHat();
+
+  for ( int i=0; i < pythia.event.size(); ++i ) {
+    if(i  == iInLepton   ) continue; 
+    if(i  == iNucleon       ) continue; 
+    if(i  == iScatLepton ) continue; 
+    if(    pythia.event[i].isNeutral()) continue;
+    if( ! (pythia.event[i].isFinal() )) continue;
+    if(rec.nHad >= Hmax) continue;
+    HadronRecord& h = rec.had[rec.nHad++];
+    h.id = pythia.event[i].id();
+    h.p  = pythia.event[i].p();
+  }
+
+  //For testing purposes 1
+  //if (pythia.event.size() > 40) 
+  //pythia.event.list(); 
       
-      int iInLepton(0), iScatLepton(0);
-      for ( int i=0; i < pythia.event.size(); ++i ) {
-	if(pythia.event[i].statusAbs()==21 && pythia.event[i].isAncestor(iLepton))
-	iInLepton = i;
-	else if(pythia.event[i].statusAbs()==23 && pythia.event[i].id()==pythia.event[iLepton].id())
-	iScatLepton = i;
-      }
+  //For testing purposes 2   
+  //if (pythia.event[iLepton].e() - pythia.event[iInLepton].e() > 100) {
+  //cout <<endl<<iLepton<<endl<<iInLepton<<endl<<iScatLepton;
+  //pythia.event.list(); }
+}
 
-      Zprim = 0; Xprim = 0; Yprim = 0;
-      if(pythia.event[iLepton].idAbs() == 13){
-	Zprim = r1 -> Uniform(-350.,-100); 
-	Xprim = r2 -> Gaus(0., 1.5); 
-	Yprim = r3 -> Gaus(0., 1.5); 
-      }
+//============================================================================
+// KINEMATIC ANALYSIS
+// Fill ev from rec, and add the hadrons to moments unless null. Uses no
+// global state, so that several analysis workers (each with its own
+// moments) can run it at the same time.
+
+void analyseEvent(const EventRecord& rec, const DetectorStage& detector,
+  DisEvent& ev, MomentAccumulator* moments){
+
+ ev.reset();
+ ev.Evt = rec.iEvent;
+ ev.wt  = rec.weight;
+ if (!rec.valid) return;
+
+ //Doubles, 4Vecs and 3Vecs for later analysis
+ 
+ TLorentzVector lvh     (0,0,0,0);
+ TLorentzVector l_nuc_i  (0,0,0,0);      //4p of proton
+ TLorentzVector l_lep_i  (0,0,0,0);      //4p of incoming lepton 
+ TLorentzVector l_lep_f  (0,0,0,0);      //4p of outcoming lepton
+ TLorentzVector p_cms   (0,0,0,0);
+ TLorentzVector Gamma   (0.,0.,0.,0.);  //4p of virtual photon
+ TLorentzVector lSpin   (0.,1.,0.,0.);
+ 
+ TVector3 iv(1.,0.,0.); //Basis Vectors
+ TVector3 jv(0.,1.,0.);
+ TVector3 kv(0.,0.,1.);
+ 
+ Double_t sinphis_GNS   ,cosphis_GNS  ;
+ Double_t sinphih_GNS   ,cosphih_GNS  ;
+ 
+ TVector3 xx   ,yy   ,zz   ;
+ TVector3 xxl  ,yyl  ,zzl  ;
+ TVector3 xxGNS,yyGNS,zzGNS;
+ TVector3 BoostGNS;
+ TVector3 SB,HB;
+ TRotation GNS;
+ TLorentzVector GammaGNS, l_lep_iGNS, l_lep_fGNS, l_nuc_iGNS;
+ TLorentzVector lSpinGNS;
+ TLorentzVector v_fot,i_lep,f_lep,f_had;
+ TLorentzVector lvhGNS;
+
+      ev.Zprim = 0; ev.Xprim = 0; ev.Yprim = 0;
+      if(rec.muon)
+	detector.vertex(rec.iEvent, ev.Xprim, ev.Yprim, ev.Zprim);
 
       // Construct q, Q2, W2, y, xbj.
-      Vec4 p0Lept    ( pythia.event[iLepton]    .p() );
-      Vec4 pInLept   ( pythia.event[iInLepton]  .p() );
-      Vec4 pScatLept ( pythia.event[iScatLepton].p() );
-      Vec4 pNucleon  ( pythia.event[iNucleon]   .p() );
+      const Vec4& p0Lept    = rec.p0Lept;
+      const Vec4& pInLept   = rec.pInLept;
+      const Vec4& pScatLept = rec.pScatLept;
+      const Vec4& pNucleon  = rec.pNucleon;
       Vec4 qtr       ( pInLept - pScatLept );
       Vec4 q         ( p0Lept  - pScatLept );
       Vec4 hadSys    ( pNucleon + qtr );
       
       double W2tr    = hadSys.m2Calc();
-      Q2tr    = -qtr.m2Calc();
-      nutr    = qtr.e();
-      Wtr     = pow( W2tr, 0.5);
-      ytr     = (pNucleon * qtr) / (pNucleon * pInLept);
-      xbjtr   = Q2tr / (2. * pNucleon * qtr);
+      ev.Q2tr    = -qtr.m2Calc();
+      ev.nutr    = qtr.e();
+      ev.Wtr     = pow( W2tr, 0.5);
+      ev.ytr     = (pNucleon * qtr) / (pNucleon * pInLept);
+      ev.xbjtr   = ev.Q2tr / (2. * pNucleon * qtr);
       
       double W2    = ( pNucleon + q ).m2Calc();
-      Q2      = -q.m2Calc();
-      nu      = q.e();
-      W       = pow( W2, 0.5);
-      y       = (pNucleon * q) / (pNucleon * p0Lept);
-      xbj     = Q2 / (2. * pNucleon * q);
+      ev.Q2      = -q.m2Calc();
+      ev.nu      = q.e();
+      ev.W       = pow( W2, 0.5);
+      ev.y       = (pNucleon * q) / (pNucleon * p0Lept);
+      ev.xbj     = ev.Q2 / (2. * pNucleon * q);
       
-      str   = pythia.info.sHat();
-      ttr   = pythia.info.tHat();
-      Evt   = iEvent;
+      ev.str   = rec.sHat;
+      ev.ttr   = rec.tHat;
       
 
-      beam_p= pInLept.pAbs();
-      beamth= acos(pInLept.pz()/pInLept.pAbs());
-      beamph= atan2(pInLept.py(), pInLept.px()) ;
+      ev.beam_p= pInLept.pAbs();
+      ev.beamth= acos(pInLept.pz()/pInLept.pAbs());
+      ev.beamph= atan2(pInLept.py(), pInLept.px()) ;
       
-      aeam_p= pNucleon.pAbs();
-      aeamth= acos(pNucleon.pz()/pNucleon.pAbs());
-      aeamph= atan2(pNucleon.py(), pNucleon.px() ) ;
+      ev.aeam_p= pNucleon.pAbs();
+      ev.aeamth= acos(pNucleon.pz()/pNucleon.pAbs());
+      ev.aeamph= atan2(pNucleon.py(), pNucleon.px() ) ;
       
-      outlep_p= pScatLept.pAbs();
-      outlepth= acos( pScatLept.pz()/ pScatLept.pAbs()) ;
-      outlepph= atan2(pScatLept.py(), pScatLept.px()) ;
+      ev.outlep_p= pScatLept.pAbs();
+      ev.outlepth= acos( pScatLept.pz()/ pScatLept.pAbs()) ;
+      ev.outlepph= atan2(pScatLept.py(), pScatLept.px()) ;
       
       Gamma.SetPxPyPzE ( q.px(), q.py(), q.pz(), q.e());
-      gathe = Gamma.Vect().Theta();
-      gaphi = Gamma.Vect().Phi();
-      gaene = Gamma.Vect().Mag();
+      ev.gathe = Gamma.Vect().Theta();
+      ev.gaphi = Gamma.Vect().Phi();
+      ev.gaene = Gamma.Vect().Mag();
 
 
       //Now using ROOT's TLorentzVector instead of PYTHIA's Vec4--------------
@@ -560,7 +552,7 @@ int main( int argc, char* argv[] ){
       
       double thetaNom = acos( l_lep_i.Vect().Dot(l_lep_f.Vect()) );
       double thetaDen = (l_lep_i.P() * l_lep_f.P());
-      theta = thetaNom / thetaDen;
+      ev.theta = thetaNom / thetaDen;
       
       
       // --- Lab Frame gamma Angles------------------------------------------- 
@@ -569,15 +561,15 @@ int main( int argc, char* argv[] ){
       yyl = l_lep_i.Vect().Cross(l_lep_f.Vect());  yyl.Unit();
       zzl = xxl.Cross(yyl);
       
-      gathx  = atan2(  Gamma.Vect().Dot(xxl),  Gamma.Vect().Dot(zzl)); 
-      gathy  = atan2(  Gamma.Vect().Dot(yyl),  Gamma.Vect().Dot(zzl));
+      ev.gathx  = atan2(  Gamma.Vect().Dot(xxl),  Gamma.Vect().Dot(zzl)); 
+      ev.gathy  = atan2(  Gamma.Vect().Dot(yyl),  Gamma.Vect().Dot(zzl));
       
        
       // --- Gamma Nucleon Frame (GNS) --------------------------------------- 
       // ---------------------------------------------------------------------
       BoostGNS  = - p_cms.Vect() * (1./p_cms.E());
-      bcm       = BoostGNS.Mag();
-      gcm       = p_cms.E()/p_cms.Mag();
+      ev.bcm    = BoostGNS.Mag();
+      ev.gcm    = p_cms.E()/p_cms.Mag();
       
       //Boost 4Vecs in other frame, same unit vectors as Lab Frame
       GammaGNS   =  Gamma ; GammaGNS.Boost (BoostGNS);
@@ -606,7 +598,6 @@ int main( int argc, char* argv[] ){
       xxGNS = xx; xxGNS.Transform(GNS);
       yyGNS = yy; yyGNS.Transform(GNS);
       zzGNS = zz; zzGNS.Transform(GNS);
-
       // cout.setf(ios::fixed);
       // cout << " lab - gamma"
       // 	   << setprecision ( 4) << setw(12) <<  Gamma.Px()
@@ -643,6 +634,7 @@ int main( int argc, char* argv[] ){
       // 	   << setprecision ( 4) << setw(12) << l_nuc_iGNS.Pz()
       // 	   << endl << endl << endl;
       
+      
       v_fot  = GammaGNS;
       i_lep  = l_lep_iGNS;
       f_lep  = l_lep_fGNS;
@@ -651,19 +643,14 @@ int main( int argc, char* argv[] ){
       float phs_den = (zzGNS.Cross(i_lep.Vect()).Mag()*zzGNS.Cross(SB).Mag());
       sinphis_GNS = zzGNS.Cross(i_lep.Vect()).Dot(SB) / phs_den;
       cosphis_GNS = zzGNS.Cross(i_lep.Vect()).Dot(zzGNS.Cross(SB))/ phs_den; 
-      phi_s = atan2(sinphis_GNS, cosphis_GNS); 
+      ev.phi_s = atan2(sinphis_GNS, cosphis_GNS); 
       
       
       //--- Hadrons' analysis-------------------------------------------------
       //----------------------------------------------------------------------
-      for ( int i=0; i < pythia.event.size(); ++i ) {
-	if(i  == iInLepton   ) continue; 
-	if(i  == iNucleon       ) continue; 
-	if(i  == iScatLepton ) continue; 
-	if(    pythia.event[i].isNeutral()) continue;
-	if( ! (pythia.event[i].isFinal() )) continue;
-	if(HadNb >= Hmax) continue;
-	Vec4 pHadron( pythia.event[i].p() );
+      for ( int i=0; i < rec.nHad; ++i ) {
+	const HadronRecord& h = rec.had[i];
+	const Vec4& pHadron = h.p;
         lvh.SetPxPyPzE(pHadron.px(),pHadron.py(),pHadron.pz(),pHadron.e());
 	
 	// ---- Rotations to GNS ( better GNS ) ------------------------------
@@ -677,35 +664,829 @@ int main( int argc, char* argv[] ){
 	sinphih_GNS = (i_lep.Vect().Cross(HB)).Dot(zzGNS) / ph_den;
 	//sinphih_GNS = zzGNS.Cross(i_lep.Vect()).Dot(HB) / ph_den;	
 
-	ch   [HadNb] = pythia.event[i].id();
-	eh   [HadNb] = lvh.E()   ;
-	ph   [HadNb] = lvh.Rho() ;
-	zh   [HadNb] = pNucleon*pHadron / (pNucleon * q);
-	pth  [HadNb] = f_had.Pt(v_fot.Vect());
-	//xfh  [HadNb] = PaAlgo::Xf(l_lep_iGNS, l_lep_fGNS, lvhGNS);
-	etah [HadNb] = lvhGNS.Rapidity();
-	phi_h[HadNb] = atan2(sinphih_GNS, cosphih_GNS);
-	theha[HadNb] = lvh.Vect().Theta() ;
-	phiha[HadNb] = lvh.Vect().Phi() ;
-
-	HadNb++;
+	int n = ev.HadNb;
+	ev.ch   [n] = h.id;
+	ev.eh   [n] = lvh.E()   ;
+	ev.ph   [n] = lvh.Rho() ;
+	ev.zh   [n] = pNucleon*pHadron / (pNucleon * q);
+	ev.pth  [n] = f_had.Pt(v_fot.Vect());
+	//ev.xfh  [n] = PaAlgo::Xf(l_lep_iGNS, l_lep_fGNS, lvhGNS);
+	ev.etah [n] = lvhGNS.Rapidity();
+	ev.phi_h[n] = atan2(sinphih_GNS, cosphih_GNS);
+	ev.theha[n] = lvh.Vect().Theta() ;
+	ev.phiha[n] = lvh.Vect().Phi() ;
+	if (moments) moments->fill(ev.xbj, ev.Q2, ev.zh[n], ev.pth[n],
+	                           ev.phi_h[n], ev.phi_s, rec.weight);
+
+	ev.HadNb++;
       //END KINEMATIC ANALYSIS------------------------------------------------
       //----------------------------------------------------------------------    	
       }      
       
-      //For testing purposes 1
-      //if (pythia.event.size() > 40) 
-      //pythia.event.list(); 
-      
-      //For testing purposes 2   
-      //if (pythia.event[iLepton].e() - pythia.event[iInLepton].e() > 100) {
-      //cout <<endl<<iLepton<<endl<<iInLepton<<endl<<iScatLepton;
-      //pythia.event.list(); }
+      //--- Detector response ------------------------------------------------
+      //----------------------------------------------------------------------
+      // Scattered lepton as track 0, then all hadrons in one batch; SelV
+      // and SelH flag what falls into the acceptance.
+      const DetectorSetup& setup = detector.parameters();
+      int accLepton = 0;
+      detector.smear(rec.iEvent, 0, 1, setup.pMinLepton,
+                     &ev.outlep_p, &ev.outlepth, &ev.outlepph,
+                     &ev.outlep_pdet, &ev.outlepthdet, &ev.outlepphdet,
+                     &accLepton);
+      detector.smear(rec.iEvent, 1, ev.HadNb, setup.pMinHadron,
+                     ev.ph, ev.theha, ev.phiha,
+                     ev.phdet, ev.thehadet, ev.phihadet, ev.SelH);
+      ev.SelV = accLepton;
+
+      Vec4 pScatDet( ev.outlep_pdet * sin(ev.outlepthdet) * cos(ev.outlepphdet),
+                     ev.outlep_pdet * sin(ev.outlepthdet) * sin(ev.outlepphdet),
+                     ev.outlep_pdet * cos(ev.outlepthdet),
+                     sqrt( pow2(ev.outlep_pdet) + pScatLept.m2Calc() ) );
+      Vec4 qdet ( p0Lept - pScatDet );
+      ev.Q2det   = -qdet.m2Calc();
+      ev.nudet   = qdet.e();
+      ev.Wdet    = pow( (pNucleon + qdet).m2Calc(), 0.5);
+      ev.ydet    = (pNucleon * qdet) / (pNucleon * p0Lept);
+      ev.xbjdet  = ev.Q2det / (2. * pNucleon * qdet);
+      for (int ih = 0; ih < ev.HadNb; ++ih) {
+        Vec4 pHadDet( ev.phdet[ih] * sin(ev.thehadet[ih]) * cos(ev.phihadet[ih]),
+                      ev.phdet[ih] * sin(ev.thehadet[ih]) * sin(ev.phihadet[ih]),
+                      ev.phdet[ih] * cos(ev.thehadet[ih]),
+                      sqrt( pow2(ev.phdet[ih]) + pow2(ev.eh[ih]) - pow2(ev.ph[ih]) ) );
+        ev.zhdet[ih] = (pNucleon * pHadDet) / (pNucleon * qdet);
+      }
+}
+
+//============================================================================
+// CHECKPOINTS
+// A checkpoint holds everything needed to continue a run exactly where it
+// stopped: the next event to generate, the running sums, the pre-run cross
+// sections and Pythia's random state (the detector stage needs none, its
+// random numbers follow from the event number). It is written together with an
+// AutoSave of the dis tree, so tree and checkpoint describe the same events.
+
+// Checkpoint files are named ckptName + ".root" and ckptName + "_<event>.rndm";
+// each MPI rank has its own.
+string ckptName = "main777ckpt";
+
+struct RunState {
+  Int_t    iNext;                  // next event to generate
+  Int_t    mpiSize, mpiRank;       // the job's rank and slice [iBegin, iEnd)
+  Int_t    iBegin, iEnd;           // of the events, which resume must match
+  Long64_t nEntries;               // dis tree entries at checkpoint
+  Int_t    nAccept;                // pre-run results
+  double   xs, nAcceptSH;
+  double   wmin, wmax, sumwt, sumwtsq, wtcount;
+  double   sigmaTotal, errorTotal, sigmaSample, errorSample;
+  double   sigmaGen, sigmaErr;       // Pythia's estimate up to the checkpoint
+  Long64_t nGen;                     // and the events accepted for it
+  vector<double> xsecLO, nAcceptLO;
+  string   rndmFile;               // Pythia random state (binary dump)
+  TH1F*    histWT;                 // weight histogram, only when loading
+  MomentAccumulator moments;       // azimuthal moments so far
+  Float16Report f16;               // float16 errors so far
+};
+
+// Write through a temporary file renamed only once complete, so that a job
+// killed while checkpointing still finds the previous checkpoint.
+bool saveCheckpoint(RunState& st, TTree* tree, TH1F* histWT, Pythia& pythia){
+
+  // Named after the event, so the old state survives until the rename.
+  string rndmOld = st.rndmFile;
+  st.rndmFile = ckptName + "_" + to_string(st.iNext) + ".rndm";
+  if (!pythia.rndm.dumpState(st.rndmFile)) return false;
+
+  tree->AutoSave("SaveSelf");
+  st.nEntries = tree->GetEntries();
+
+  TDirectory* dir = gDirectory;
+  string ckptFile = ckptName + ".root";
+  string tmpFile  = ckptFile + ".tmp";
+  TFile* f = TFile::Open(tmpFile.c_str(), "RECREATE");
+  if (!f || f->IsZombie()) { dir->cd(); return false; }
+  TTree* ckpt = new TTree("ckpt", "main777 checkpoint");
+  vector<double>* xsecLO    = &st.xsecLO;
+  vector<double>* nAcceptLO = &st.nAcceptLO;
+  ckpt->Branch("iNext"      ,&st.iNext      ,"iNext/I"      );
+  ckpt->Branch("nEntries"   ,&st.nEntries   ,"nEntries/L"   );
+  ckpt->Branch("mpiSize"    ,&st.mpiSize    ,"mpiSize/I"    );
+  ckpt->Branch("mpiRank"    ,&st.mpiRank    ,"mpiRank/I"    );
+  ckpt->Branch("iBegin"     ,&st.iBegin     ,"iBegin/I"     );
+  ckpt->Branch("iEnd"       ,&st.iEnd       ,"iEnd/I"       );
+  ckpt->Branch("nAccept"    ,&st.nAccept    ,"nAccept/I"    );
+  ckpt->Branch("xs"         ,&st.xs         ,"xs/D"         );
+  ckpt->Branch("nAcceptSH"  ,&st.nAcceptSH  ,"nAcceptSH/D"  );
+  ckpt->Branch("wmin"       ,&st.wmin       ,"wmin/D"       );
+  ckpt->Branch("wmax"       ,&st.wmax       ,"wmax/D"       );
+  ckpt->Branch("sumwt"      ,&st.sumwt      ,"sumwt/D"      );
+  ckpt->Branch("sumwtsq"    ,&st.sumwtsq    ,"sumwtsq/D"    );
+  ckpt->Branch("wtcount"    ,&st.wtcount    ,"wtcount/D"    );
+  ckpt->Branch("sigmaTotal" ,&st.sigmaTotal ,"sigmaTotal/D" );
+  ckpt->Branch("errorTotal" ,&st.errorTotal ,"errorTotal/D" );
+  ckpt->Branch("sigmaSample",&st.sigmaSample,"sigmaSample/D");
+  ckpt->Branch("errorSample",&st.errorSample,"errorSample/D");
+  ckpt->Branch("sigmaGen"   ,&st.sigmaGen   ,"sigmaGen/D"   );
+  ckpt->Branch("sigmaErr"   ,&st.sigmaErr   ,"sigmaErr/D"   );
+  ckpt->Branch("nGen"       ,&st.nGen       ,"nGen/L"       );
+  ckpt->Branch("xsecLO"     ,&xsecLO   );
+  ckpt->Branch("nAcceptLO"  ,&nAcceptLO);
+  ckpt->Fill();
+  f->WriteTObject(ckpt);
+  f->WriteTObject(histWT, "histWT");
+  TNamed rndm("rndm", st.rndmFile.c_str());
+  f->WriteTObject(&rndm);
+  if (!st.moments.empty()) st.moments.write(f);
+  if (!st.f16.empty()) st.f16.write(f);
+  f->Close();
+  delete f;
+  dir->cd();
+
+  if (rename(tmpFile.c_str(), ckptFile.c_str()) != 0) return false;
+  if (rndmOld != "") remove(rndmOld.c_str());
+  return true;
+}
+
+bool loadCheckpoint(RunState& st){
+
+  TDirectory* dir = gDirectory;
+  TFile* f = TFile::Open((ckptName + ".root").c_str(), "READ");
+  if (!f || f->IsZombie()) { dir->cd(); return false; }
+  TTree* ckpt   = (TTree*) f->Get("ckpt");
+  TNamed* rndm  = (TNamed*) f->Get("rndm");
+  st.histWT     = (TH1F*) f->Get("histWT");
+  if (!ckpt || !rndm || !st.histWT) { f->Close(); dir->cd(); return false; }
+  vector<double>* xsecLO    = 0;
+  vector<double>* nAcceptLO = 0;
+  st.sigmaGen = st.sigmaErr = 0.;
+  st.nGen     = 0;
+  st.mpiSize  = st.mpiRank = st.iBegin = st.iEnd = -1;
+  ckpt->SetBranchAddress("iNext"      ,&st.iNext      );
+  ckpt->SetBranchAddress("nEntries"   ,&st.nEntries   );
+  ckpt->SetBranchAddress("nAccept"    ,&st.nAccept    );
+  ckpt->SetBranchAddress("xs"         ,&st.xs         );
+  ckpt->SetBranchAddress("nAcceptSH"  ,&st.nAcceptSH  );
+  ckpt->SetBranchAddress("wmin"       ,&st.wmin       );
+  ckpt->SetBranchAddress("wmax"       ,&st.wmax       );
+  ckpt->SetBranchAddress("sumwt"      ,&st.sumwt      );
+  ckpt->SetBranchAddress("sumwtsq"    ,&st.sumwtsq    );
+  ckpt->SetBranchAddress("wtcount"    ,&st.wtcount    );
+  ckpt->SetBranchAddress("sigmaTotal" ,&st.sigmaTotal );
+  ckpt->SetBranchAddress("errorTotal" ,&st.errorTotal );
+  ckpt->SetBranchAddress("sigmaSample",&st.sigmaSample);
+  ckpt->SetBranchAddress("errorSample",&st.errorSample);
+  if (ckpt->GetBranch("iEnd")) {
+    ckpt->SetBranchAddress("mpiSize"  ,&st.mpiSize    );
+    ckpt->SetBranchAddress("mpiRank"  ,&st.mpiRank    );
+    ckpt->SetBranchAddress("iBegin"   ,&st.iBegin     );
+    ckpt->SetBranchAddress("iEnd"     ,&st.iEnd       );
+  }
+  if (ckpt->GetBranch("nGen")) {
+    ckpt->SetBranchAddress("sigmaGen" ,&st.sigmaGen   );
+    ckpt->SetBranchAddress("sigmaErr" ,&st.sigmaErr   );
+    ckpt->SetBranchAddress("nGen"     ,&st.nGen       );
+  }
+  ckpt->SetBranchAddress("xsecLO"     ,&xsecLO        );
+  ckpt->SetBranchAddress("nAcceptLO"  ,&nAcceptLO     );
+  ckpt->GetEntry(0);
+  st.xsecLO    = *xsecLO;
+  st.nAcceptLO = *nAcceptLO;
+  st.rndmFile  = rndm->GetTitle();
+  st.moments.read(f);
+  st.f16.read(f);
+  st.histWT->SetDirectory(0);
+  f->Close();
+  delete f;
+  dir->cd();
+  return true;
+}
+
+//============================================================================
+
+// The whole run; main() below wraps it in MPI_Init and MPI_Finalize when
+// built as main777mpi.
+int run( int argc, char* argv[] ){
+
+  // Continue from the last checkpoint instead of starting afresh, or
+  // initialize once and fork nFork workers sharing the events.
+  bool resume = false;
+  int  nFork  = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--resume") == 0) resume = true;
+    else if (strcmp(argv[i], "--fork") == 0 && i + 1 < argc)
+      nFork = atoi(argv[++i]);
+  }
+  if (resume && nFork > 0) {
+    cout << "Error: --resume and --fork cannot be combined" << endl;
+    return 1;
+  }
+
+  // MPI rank of this job and number of ranks; 0 and 1 without MPI. Only
+  // rank 0 prints to the terminal, the others to main777_<rank>.out. Each
+  // rank keeps its own checkpoint, so --resume needs the same -np again.
+  int mpiRank = 0, mpiSize = 1;
+#ifdef MAIN777MPI
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+  MPI_Comm_size(MPI_COMM_WORLD, &mpiSize);
+  if (nFork > 0) {
+    cout << "Error: --fork cannot be used in an MPI run" << endl;
+    return 1;
+  }
+  if (mpiRank > 0) {
+    string out = "main777_" + to_string(mpiRank) + ".out";
+    if (!freopen(out.c_str(), resume ? "a" : "w", stdout)) return 1;
+  }
+  ckptName += "_" + to_string(mpiRank);
+#endif
+
+
+
+  //==========================================================================
+  //PREPARATION    PREPARATION    PREPARATION    PREPARATION    PREPARATION 
+  //==========================================================================
+  // Save estimates in vectors.
+  vector<double> xsecLO;
+  vector<double> nSelectedLO;
+  vector<double> nAcceptLO;
+  vector<int>    strategyLO;
+
+
+  DisEvent ev;    // what the dis tree branches point at
+
+ static TTree* tree(NULL);
+
+ RunState st = RunState();
+ if (resume && !loadCheckpoint(st)) {
+   cout << "Error: cannot read checkpoint " << ckptName << ".root" << endl;
+   return 1;
+ }
+
+
+
+ 
+ 
+  //=========================================================================
+  //INITIALIZATION    INITIALIZATION    INITIALIZATION    INITIALIZATION  ===   
+  //=========================================================================
+  
+  Pythia pythia;
+  // Events between checkpoints (0 = no checkpoints).
+  pythia.settings.addMode("Main777:checkpointEvery", 0, true, false, 0, 0);
+  // Analysis threads behind the generator (0 = all in one thread) and
+  // events each stage queue can hold.
+  pythia.settings.addMode("Main777:pipelineWorkers", 0, true, false, 0, 0);
+  pythia.settings.addMode("Main777:pipelineQueue", 64, true, false, 1, 0);
+  // Events buffered for the tree writer and ROOT threads compressing
+  // baskets (0 = compression on the writer thread).
+  pythia.settings.addMode("Main777:writerQueue", 256, true, false, 1, 0);
+  pythia.settings.addMode("Main777:writerImt", 0, true, false, 0, 0);
+
+  // Azimuthal moments in bins of x, Q2, z and pT, and whether the hadrons
+  // are written to the tree as well.
+  pythia.settings.addFlag("Main777:moments", true);
+  pythia.settings.addFlag("Main777:hadronBranches", true);
+  pythia.settings.addPVec("Main777:momentBinsX",
+    {0.003, 0.008, 0.013, 0.02, 0.032, 0.05, 0.08, 0.13, 0.21, 0.7},
+    false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:momentBinsQ2",
+    {1., 3., 10., 100.}, false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:momentBinsZ",
+    {0.2, 0.25, 0.3, 0.35, 0.4, 0.5, 0.65, 0.8, 1.}, false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:momentBinsPT",
+    {0.1, 0.2, 0.3, 0.4, 0.5, 0.64, 0.8, 1., 1.3}, false, false, 0., 0.);
+
+  // Index of the tree entries in coarse bins of xbj, Q2, y and W, written
+  // to main777index.root, and events per tree cluster sorted by that bin
+  // (0 = generation order, which leaves about one index range per entry).
+  pythia.settings.addFlag("Main777:index", true);
+  pythia.settings.addMode("Main777:indexSort", 0, true, false, 0, 0);
+  pythia.settings.addPVec("Main777:indexBinsX",
+    {0.003, 0.01, 0.02, 0.05, 0.1, 0.2, 0.7}, false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:indexBinsQ2",
+    {1., 2., 4., 10., 100.}, false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:indexBinsY",
+    {0.1, 0.2, 0.3, 0.5, 0.7, 0.9}, false, false, 0., 0.);
+  pythia.settings.addPVec("Main777:indexBinsW",
+    {5., 7., 10., 13., 18.}, false, false, 0., 0.);
+
+  // Branches written as Float16_t, "name:xmin:xmax:nbits" (range packed
+  // in nbits) or "name:nbits" (mantissa bits), see main777Float16.h.
+  pythia.settings.addFlag("Main777:float16", true);
+  pythia.settings.addWVec("Main777:float16Branches", {
+    "theha:14", "phiha:14", "phi_h:12", "zh:14", "gathe:12", "gaphi:12",
+    "phi_s:12", "y:12"});
+
+  // Detector stage: vertex, resolutions and acceptance (cm, GeV, rad).
+  pythia.settings.addMode("Main777:detectorSeed", 1, true, false, 0, 0);
+  pythia.settings.addParm("Main777:zMin",      -350., false, false, 0., 0.);
+  pythia.settings.addParm("Main777:zMax",      -100., false, false, 0., 0.);
+  pythia.settings.addParm("Main777:sigmaXY",     1.5, true, false, 0., 0.);
+  pythia.settings.addParm("Main777:sigmaPRel", 0.005, true, false, 0., 0.);
+  pythia.settings.addParm("Main777:sigmaPQuad",1e-4,  true, false, 0., 0.);
+  pythia.settings.addParm("Main777:sigmaTheta",2e-4,  true, false, 0., 0.);
+  pythia.settings.addParm("Main777:sigmaPhi",  2e-3,  true, false, 0., 0.);
+  pythia.settings.addParm("Main777:thetaMax",   0.18, true, false, 0., 0.);
+  pythia.settings.addParm("Main777:pMinLepton",  2.0, true, false, 0., 0.);
+  pythia.settings.addParm("Main777:pMinHadron",  1.0, true, false, 0., 0.);
+  pythia.readFile  (argv[1]);
+  int ckptEvery = pythia.mode("Main777:checkpointEvery");
+  int nWorkers  = pythia.mode("Main777:pipelineWorkers");
+  int queueSize = pythia.mode("Main777:pipelineQueue");
+  int writerQueue = pythia.mode("Main777:writerQueue");
+  int writerImt   = pythia.mode("Main777:writerImt");
+  bool doMoments  = pythia.flag("Main777:moments");
+  bool hadrons    = pythia.flag("Main777:hadronBranches");
+  vector<double> momentBins[MomentAccumulator::nDim] = {
+    pythia.settings.pvec("Main777:momentBinsX"),
+    pythia.settings.pvec("Main777:momentBinsQ2"),
+    pythia.settings.pvec("Main777:momentBinsZ"),
+    pythia.settings.pvec("Main777:momentBinsPT") };
+  bool doIndex    = pythia.flag("Main777:index");
+  int  indexSort  = doIndex ? pythia.mode("Main777:indexSort") : 0;
+  vector<double> indexBins[KinIndex::nDim] = {
+    pythia.settings.pvec("Main777:indexBinsX"),
+    pythia.settings.pvec("Main777:indexBinsQ2"),
+    pythia.settings.pvec("Main777:indexBinsY"),
+    pythia.settings.pvec("Main777:indexBinsW") };
+  KinIndex index(indexBins);
+  vector<Float16Spec> f16Specs;
+  string f16Bad;
+  if (pythia.flag("Main777:float16") && !parseFloat16(
+    pythia.settings.wvec("Main777:float16Branches"), f16Specs, f16Bad)) {
+    cout << "Error: cannot use Main777:float16Branches entry " << f16Bad
+         << endl;
+    return 1;
+  }
+  Float16Report f16(f16Specs);
+  if (resume && !f16.empty() && !f16.add(st.f16))
+    cout << "Warning: float16 branches differ from the checkpoint, their"
+         << " errors cover only the resumed events" << endl;
+
+  DetectorSetup setup;
+  setup.zMin       = pythia.parm("Main777:zMin");
+  setup.zMax       = pythia.parm("Main777:zMax");
+  setup.sigmaXY    = pythia.parm("Main777:sigmaXY");
+  setup.sigmaPRel  = pythia.parm("Main777:sigmaPRel");
+  setup.sigmaPQuad = pythia.parm("Main777:sigmaPQuad");
+  setup.sigmaTheta = pythia.parm("Main777:sigmaTheta");
+  setup.sigmaPhi   = pythia.parm("Main777:sigmaPhi");
+  setup.thetaMax   = pythia.parm("Main777:thetaMax");
+  setup.pMinLepton = pythia.parm("Main777:pMinLepton");
+  setup.pMinHadron = pythia.parm("Main777:pMinHadron");
+  
+  int nEvent = pythia.mode("Main:numberOfEvents");
+
+  // Events iBegin to iEnd of this job and its seed; worker or rank iWorker
+  // of a forked or MPI run (-1 otherwise) writes main777tree_<iWorker>.root.
+  int iWorker = -1;
+  int iBegin  = 0;
+  int iEnd    = nEvent;
+  int runSeed = pythia.settings.flag("Random:setSeed")
+              ? pythia.settings.mode("Random:seed") : -1;
+  if (runSeed < 0) runSeed = 19780503;   // Pythia's default seed
+
+  // MPI run: rank r seeds with seed + 1 + r before anything is initialized
+  // and takes the r-th slice of the events. Rank 0 alone makes the pre-run
+  // and broadcasts its results; nothing else is shared until the metadata
+  // are gathered at the end.
+  if (mpiSize > 1) {
+    iWorker = mpiRank;
+    runSeed += 1 + mpiRank;
+    pythia.settings.flag("Random:setSeed", true);
+    pythia.settings.mode("Random:seed", runSeed);
+    iBegin = long(nEvent) * mpiRank / mpiSize;
+    iEnd   = long(nEvent) * (mpiRank + 1) / mpiSize;
+  }
+
+
+  //=========================================================================
+  // CROSS SECTION ESTIMATE RUN =============================================
+  //=========================================================================
+  
+  //Switch OFF all showering and MPI when estimating the cross section, 
+  //then re-initialise (unfortunately).
+  bool fsr = pythia.flag("PartonLevel:FSR");
+  bool isr = pythia.flag("PartonLevel:ISR");
+  bool mpi = pythia.flag("PartonLevel:MPI");
+  bool had = pythia.flag("HadronLevel:all");
+  bool rem = pythia.flag("PartonLevel:Remnants");
+  bool chk = pythia.flag("Check:Event");
+  int nCount = pythia.settings.mode("Next:numberCount");
+  pythia.settings.flag("PartonLevel:FSR",     false);
+  pythia.settings.flag("PartonLevel:ISR",     false);
+  pythia.settings.flag("PartonLevel:MPI",     false);
+  pythia.settings.flag("HadronLevel:all",     false);
+  pythia.settings.flag("PartonLevel:Remnants",false);
+  pythia.settings.flag("Check:Event",         false);
+  pythia.settings.mode("Next:numberCount",nEvent);
+  
+  double sumSH     = 0.;
+  double nAcceptSH = 0.;
+  int    nAccept   = 0;
+  double xs        = 0.;
+
+  // A resumed run takes the pre-run results from the checkpoint instead,
+  // the other MPI ranks receive them from rank 0.
+  if (resume) {
+    xsecLO    = st.xsecLO;
+    nAcceptLO = st.nAcceptLO;
+    nAcceptSH = st.nAcceptSH;
+    nAccept   = st.nAccept;
+    xs        = st.xs;
+  }
+  else if (mpiRank == 0) {
+    pythia.init();
+  
+    for( int iEvent=0; iEvent<nEvent; ++iEvent ){
+    
+      if( !pythia.next() ) {
+        if( pythia.info.atEndOfFile() )
+          break;
+        else continue;
+        }
+
+      sumSH     += pythia.info.weight();
+    
+      //Build a map from a certain string to a certain other string
+      map <string,string> eventAttributes;
+      //pythia.info.eventAttributes is a pointer to a <string,string> map 
+      //and public attribute of pythia::info
+      if (pythia.info.eventAttributes) {
+        eventAttributes = *(pythia.info.eventAttributes); //retrieve the map
+        string trials = (eventAttributes.find("trials") != eventAttributes.end())
+                        ?  eventAttributes["trials"] : "";
+        if (trials != "") {nAcceptSH += atof (trials.c_str()) ;}
+     
+       xsecLO.push_back(pythia.info.sigmaGen(iEvent));
+       nAcceptLO.push_back(pythia.info.nAccepted(iEvent));
+      }
     }
-    tree -> Fill(); 
+  
+    pythia.stat();
+
+    nAccept   = pythia.info.nAccepted(); //accepted events by pythia and user
+    xs        = pythia.info.sigmaGen();  //estimated cross section
+  }
+#ifdef MAIN777MPI
+  if (mpiSize > 1 && !resume) {
+    long nLO = xsecLO.size();
+    MPI_Bcast(&nAccept,   1, MPI_INT,    0, MPI_COMM_WORLD);
+    MPI_Bcast(&xs,        1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&nAcceptSH, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&nLO,       1, MPI_LONG,   0, MPI_COMM_WORLD);
+    xsecLO.resize(nLO);
+    nAcceptLO.resize(nLO);
+    MPI_Bcast(xsecLO.data(),    nLO, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(nAcceptLO.data(), nLO, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  }
+#endif
+  
+
+  
+  //===========================================================================
+  // EVENT GENERATION LOOP=====================================================
+  //===========================================================================
+   
+  pythia.settings.mode("Next:numberCount", nCount);
+
+  // Cross section and error.
+  double sigmaTotal  = 0.;
+  double errorTotal  = 0.;
+
+  double sigmaSample = 0., errorSample = 0.;
+  
+  // Switch showering and multiple interaction back to original setting.
+  pythia.settings.flag("PartonLevel:FSR",fsr);
+  pythia.settings.flag("PartonLevel:ISR",isr);
+  pythia.settings.flag("HadronLevel:all",had);
+  pythia.settings.flag("PartonLevel:MPI",mpi);
+  pythia.settings.flag("PartonLevel:Remnants",rem);
+  pythia.settings.flag("Check:Event",chk);
+  pythia.init();
+
+  // Forked run: the workers share everything initialized so far (settings,
+  // PDF grids, particle data, pre-run results) with the launcher, copy on
+  // write. Worker i reseeds with seed + 1 + i, takes the i-th slice of the
+  // events and writes main777tree_i.root, main777hist_i.root and
+  // main777_i.out; the launcher only waits for them.
+  if (nFork > 0) {
+    fflush(stdout);    // else each worker prints the buffered output again
+    vector<pid_t> pids;
+    for (int i = 0; i < nFork; ++i) {
+      pid_t pid = fork();
+      if (pid == 0) { iWorker = i; break; }
+      if (pid < 0) { cout << "Error: cannot fork worker " << i << endl; break; }
+      pids.push_back(pid);
+    }
+    if (iWorker < 0) {
+      int nFailed = nFork - pids.size();
+      for (size_t i = 0; i < pids.size(); ++i) {
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          cout << "Error: worker " << i << " failed" << endl;
+          ++nFailed;
+        }
+      }
+      cout << nFork - nFailed << " of " << nFork << " workers done;"
+           << " merge their output with ./main778" << endl;
+      return nFailed > 0 ? 1 : 0;
+    }
+    string out = "main777_" + to_string(iWorker) + ".out";
+    if (!freopen(out.c_str(), "w", stdout)) return 1;
+    runSeed += 1 + iWorker;
+    pythia.rndm.init(runSeed);
+    iBegin = long(nEvent) * iWorker / nFork;
+    iEnd   = long(nEvent) * (iWorker + 1) / nFork;
+    if (ckptEvery > 0) {
+      cout << "Warning: no checkpoints in forked runs" << endl;
+      ckptEvery = 0;
+    }
+  }
+
+  // The detector random numbers follow from (detectorSeed, runSeed, event),
+  // so jobs with different seeds smear their events independently.
+  DetectorStage detector(setup, pythia.mode("Main777:detectorSeed"), runSeed);
+
+  string suffix   = iWorker < 0 ? "" : "_" + to_string(iWorker);
+  string treeFile = "main777tree" + suffix + ".root";
+  string histFile = "main777hist" + suffix + ".root";
+  string indexFile = "main777index" + suffix + ".root";
+
+  // The tree lives in its file from the start, so that baskets are flushed
+  // to disk as they fill instead of being kept in memory until the end.
+  TFile *hfile = TFile::Open(treeFile.c_str(), resume ? "UPDATE" : "RECREATE");
+  if (!hfile || hfile->IsZombie()) {
+    cout << "Error: cannot open " << treeFile << endl;
+    return 1;
+  }
+
+  //Create the TTree, or pick up the one of the interrupted run
+  if (resume) tree = (TTree*) hfile->Get("dis");
+  else tree = new TTree("dis","DIS tree"); // name (has to be unique) and title of the Ntuple
+  if (!tree) {
+    cout << "Error: no dis tree to resume in " << treeFile << endl;
+    return 1;
+  }
+  // Only checkpoints save the tree header, to keep it in step with them.
+  tree->SetAutoSave(0);
+
+  bookBranches(tree, ev, resume, hadrons, &f16);
+  if (!f16.allBooked(f16Bad)) {
+    cout << "Error: Main777:float16Branches entry " << f16Bad
+         << " is not a float branch of the dis tree" << endl;
+    return 1;
+  }
+
+  double wmax    =-1e15; 
+  double wmin    = 1e15;
+  double sumwt   = 0.;
+  double sumwtsq = 0.;
+  double wtcount = 0.;
+  
+  // Root-Histogram the weights (kept out of the tree file, see the end)
+  TH1F *histWT = new TH1F("histWT", "Weights", 5000000, -1000., 1000.);
+  histWT -> SetDirectory(0);
+
+  // Pick up where the checkpoint left off. Restoring the random states
+  // after init() gives the remaining events the same random sequence as
+  // an uninterrupted run; pythia.stat() covers only the resumed part.
+  int iFirst = iBegin;
+  if (resume) {
+    // Another -np or number of events gives another slice: continuing at
+    // iNext would repeat or skip events.
+    if (st.mpiSize != mpiSize || st.mpiRank != mpiRank
+      || st.iBegin != iBegin || st.iEnd != iEnd) {
+      cout << "Error: checkpoint of events " << st.iBegin << " to "
+           << st.iEnd << " of rank " << st.mpiRank << " of " << st.mpiSize
+           << ", this job has events " << iBegin << " to " << iEnd
+           << " of rank " << mpiRank << " of " << mpiSize << endl;
+      return 1;
+    }
+    if (!pythia.rndm.readState(st.rndmFile)) {
+      cout << "Error: cannot read random state " << st.rndmFile << endl;
+      return 1;
+    }
+    wmin        = st.wmin;
+    wmax        = st.wmax;
+    sumwt       = st.sumwt;
+    sumwtsq     = st.sumwtsq;
+    wtcount     = st.wtcount;
+    sigmaTotal  = st.sigmaTotal;
+    errorTotal  = st.errorTotal;
+    sigmaSample = st.sigmaSample;
+    errorSample = st.errorSample;
+    histWT -> Add(st.histWT);
+    delete st.histWT;
+    st.histWT = 0;
+    iFirst = st.iNext;
+
+    // Entries filled after the last checkpoint but saved by an interrupted
+    // one are dropped, copying the tree up to the checkpoint.
+    if (tree->GetEntries() != st.nEntries) {
+      TTree* treeOld = tree;
+      tree = treeOld->CloneTree(0);
+      for (Long64_t i = 0; i < st.nEntries; ++i) {
+        treeOld->GetEntry(i);
+        tree->Fill();
+      }
+      tree->SetAutoSave(0);
+      tree->AutoSave("SaveSelf");
+    }
+    cout << "Resuming from event " << iFirst << endl;
+  }
+  
+
+  // Moments of each analysis thread, added up at checkpoints and the end;
+  // a resumed run continues the sums of the checkpoint.
+  vector<MomentAccumulator> moments(max(nWorkers, 1));
+  if (doMoments) {
+    for (size_t iw = 0; iw < moments.size(); ++iw)
+      moments[iw].init(momentBins);
+    if (resume && !moments[0].add(st.moments)) {
+      cout << "Error: moment binning differs from the checkpoint" << endl;
+      return 1;
+    }
+  }
+  auto sumMoments = [&]() {
+    MomentAccumulator all;
+    for (size_t iw = 0; iw < moments.size(); ++iw) all.add(moments[iw]);
+    return all;
+  };
+
+  // Pythia's cross section estimate counts only the events since init();
+  // a resumed run adds the estimate saved with the checkpoint, weighted
+  // with the accepted events.
+  RunMeta genPrev = RunMeta();
+  if (resume) {
+    genPrev.sigma   = st.sigmaGen;
+    genPrev.error   = st.sigmaErr;
+    genPrev.nAccept = st.nGen;
+  }
+  auto sigmaGen = [&]() {
+    RunMeta now = RunMeta();
+    now.sigma   = pythia.info.sigmaGen();
+    now.error   = pythia.info.sigmaErr();
+    now.nAccept = pythia.info.nAccepted();
+    return combineMeta(vector<RunMeta>{genPrev, now});
+  };
+
+  // The tree is filled and written by a background writer, fed with
+  // analysed events through one queue, or one per worker in pipelined mode.
+  // Pipelined mode: this thread generates (one Pythia instance cannot be
+  // shared between threads) and hands each event record round-robin to
+  // nWorkers analysis threads; the writer collects their results in the
+  // same round-robin order, so the tree keeps the generation order. With
+  // Main777:indexSort it is kept only between clusters, whose events are
+  // grouped by index bin (Evt still gives the event number).
+  if (indexSort > 0) tree->SetAutoFlush(indexSort);
+  AsyncTreeWriter<DisEvent> writer(tree, ev, max(nWorkers, 1), writerQueue,
+    writerImt, indexSort, [&index](const DisEvent& e) {
+      return index.bin(e.xbj, e.Q2, e.y, e.W); },
+    [&f16](const DisEvent&) { f16.check(); });
+  vector<RingBuffer<EventRecord>*> recQueue;
+  vector<thread> workers;
+  long           nPushed = 0;
+  EventRecord    rec;
+  for (int iw = 0; iw < nWorkers; ++iw)
+    recQueue.push_back(new RingBuffer<EventRecord>(queueSize));
+  for (int iw = 0; iw < nWorkers; ++iw)
+    workers.push_back(thread([&, iw]() {
+      RingBuffer<EventRecord>& in  = *recQueue[iw];
+      RingBuffer<DisEvent>&    out = writer.queue(iw);
+      while (EventRecord* r = in.front()) {
+        analyseEvent(*r, detector, out.claim(),
+                     doMoments ? &moments[iw] : 0);
+        out.publish();
+        in.release();
+      }
+      out.close();
+    }));
+  for( int iEvent=iFirst; iEvent<iEnd; ++iEvent ){
+
+    // Checkpoint before generating this event, once all events generated
+    // so far are in the tree.
+    if (ckptEvery > 0 && iEvent > iFirst && iEvent % ckptEvery == 0) {
+      writer.wait(nPushed);
+      st.iNext       = iEvent;
+      st.mpiSize     = mpiSize;
+      st.mpiRank     = mpiRank;
+      st.iBegin      = iBegin;
+      st.iEnd        = iEnd;
+      st.nAccept     = nAccept;
+      st.xs          = xs;
+      st.nAcceptSH   = nAcceptSH;
+      st.wmin        = wmin;
+      st.wmax        = wmax;
+      st.sumwt       = sumwt;
+      st.sumwtsq     = sumwtsq;
+      st.wtcount     = wtcount;
+      st.sigmaTotal  = sigmaTotal;
+      st.errorTotal  = errorTotal;
+      st.sigmaSample = sigmaSample;
+      st.errorSample = errorSample;
+      RunMeta gen    = sigmaGen();
+      st.sigmaGen    = gen.sigma;
+      st.sigmaErr    = gen.error;
+      st.nGen        = gen.nAccept;
+      st.xsecLO      = xsecLO;
+      st.nAcceptLO   = nAcceptLO;
+      st.moments     = sumMoments();
+      st.f16         = f16;
+      if (!saveCheckpoint(st, tree, histWT, pythia))
+        cout << "Warning: checkpoint at event " << iEvent << " failed" << endl;
+    }
+  
+
+    if( !pythia.next() ) {
+      if( pythia.info.atEndOfFile() )
+        break;
+      else continue;
+    }
+    
+    //-----------------------------------------------------------------------
+    //WEIGHTS ---------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    // Get event weight(s).
+    double evtweight         = pythia.info.weight();
+
+    if (abs(evtweight) > 1e3) {
+      cout << scientific << setprecision(8)
+      << "Warning: Large shower weight wt = " << evtweight << endl;
+      if (abs(evtweight) > 1e4) { 
+        cout << "Warning: Shower weight larger than 10000."
+        << "Discard event with rare shower weight fluctuation."
+        << endl;
+        evtweight = 0.;
+      }
+    }   
+    // Do not print zero-weight events.
+    if ( evtweight == 0. ) continue;
+
+    wmin     = min(wmin, evtweight);
+    wmax     = max(wmax, evtweight);
+    sumwt   += evtweight;
+    sumwtsq += pow2(evtweight);
+    wtcount += 1.;
+    histWT -> Fill (evtweight);
+    
+    // Per-event estimate of an LHEF pre-run, else the pre-run's total.
+    double normhepmc = nAccept > 0 ? xs / nAccept : 0.;
+    if (size_t(iEvent) < xsecLO.size() && size_t(iEvent) < nAcceptLO.size()
+      && nAcceptLO[iEvent] > 0)
+      normhepmc = xsecLO[iEvent] / nAcceptLO[iEvent];
+    // Weighted events with additional number of trial events to consider.
+    if ( pythia.info.lhaStrategy() != 0
+      && pythia.info.lhaStrategy() != 3
+      && nAcceptSH > 0)
+      normhepmc = 1. / (1e9*nAcceptSH);
+    // Weighted events.
+    else if ( pythia.info.lhaStrategy() != 0
+      && pythia.info.lhaStrategy() != 3
+      && nAcceptSH == 0)
+      normhepmc = 1. / (1e9*nAccept);
+
+    
+    //------------------------------------------------------------------------
+    //KINEMATIC ANALYSIS------------------------------------------------------
+    //------------------------------------------------------------------------    
+    // The event counts for the cross section only with more than the beams.
+    if(pythia.event.size() > 3){
+      sigmaTotal  += evtweight * normhepmc;
+      sigmaSample += evtweight * normhepmc;
+      errorTotal  += pow2(evtweight * normhepmc);
+      errorSample += pow2(evtweight * normhepmc);       
+    }
+
+    //------------------------------------------------------------------------
+    //KINEMATIC ANALYSIS------------------------------------------------------
+    //------------------------------------------------------------------------    
+    if (nWorkers > 0) {
+      RingBuffer<EventRecord>& q = *recQueue[nPushed % nWorkers];
+      fillRecord(pythia, iEvent, evtweight, q.claim());
+      q.publish();
+    }
+    else {
+      RingBuffer<DisEvent>& q = writer.queue(0);
+      fillRecord(pythia, iEvent, evtweight, rec);
+      analyseEvent(rec, detector, q.claim(), doMoments ? &moments[0] : 0);
+      q.publish();
+    }
+    ++nPushed;
  
   } // end loop over events to generate
 
+  // Let the pipeline run dry before the tree is written.
+  for (int iw = 0; iw < nWorkers; ++iw) recQueue[iw]->close();
+  for (int iw = 0; iw < nWorkers; ++iw) workers[iw].join();
+  writer.close();
+  cout << "\n Pipeline queues:" << endl;
+  for (int iw = 0; iw < nWorkers; ++iw) {
+    recQueue[iw]->stat("events  -> worker " + to_string(iw));
+    writer.queue(iw).stat("worker " + to_string(iw) + " -> writer");
+    delete recQueue[iw];
+  }
+  if (nWorkers == 0) writer.queue(0).stat("events  -> writer");
+
   // print cross section and errors
   pythia.stat();
 
@@ -719,22 +1500,124 @@ int main( int argc, char* argv[] ){
        << endl;
 
   // Print and write tree to file
-  TFile *hfile = TFile::Open("main777tree.root","recreate");
+  hfile  -> cd();
   tree   -> Print();
-  tree   -> Write(); 
+  tree   -> Write("", TObject::kOverwrite); 
+
+  // Metadata for merging many jobs, see main778. The cross section is
+  // Pythia's estimate from the events of this job, so every job (a forked
+  // worker or an MPI rank as well) estimates the whole and main778 can
+  // average them.
+  RunMeta gen  = sigmaGen();
+  RunMeta meta;
+  meta.sigma   = gen.sigma;
+  meta.error   = gen.error;
+  meta.sumW    = sumwt;
+  meta.sumW2   = sumwtsq;
+  meta.nAccept = Long64_t(wtcount);
+  meta.nEvent  = iEnd - iBegin;
+  meta.seed    = runSeed;
+  writeMeta(hfile, meta);
+  if (doMoments) sumMoments().write(hfile);
+  if (!f16Specs.empty()) {
+    f16.print();
+    f16.write(hfile);
+  }
+  cout << scientific << setprecision(6)
+       << "\t Cross section estimate    = " << meta.sigma
+       << " +- " << meta.error << " mb" << endl;
+
+  // Sidecar index, from the tree as written (resumed parts included).
+  if (doIndex) {
+    TFile* ifile = TFile::Open(indexFile.c_str(), "RECREATE");
+    if (ifile && !ifile->IsZombie() && index.build(tree)) {
+      index.write(ifile);
+      cout << "\t Index                     = " << index.nRuns()
+           << " entry ranges in " << index.nBinsUsed() << " bins, "
+           << indexFile << endl;
+    }
+    else cout << "Warning: cannot write " << indexFile << endl;
+    if (ifile) ifile -> Close();
+  }
   hfile  -> Close();
+
+#ifdef MAIN777MPI
+  // Global normalization: rank 0 collects the per-rank metadata and
+  // combines them as main778 does (the cross section estimates averaged,
+  // the weight sums added); both go to main777norm.root. The rank files
+  // merge with main778.
+  double wminAll, wmaxAll;
+  MPI_Reduce(&wmin, &wminAll, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&wmax, &wmaxAll, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  vector<RunMeta> metas(mpiSize);
+  MPI_Gather(&meta, sizeof(RunMeta), MPI_BYTE, metas.data(), sizeof(RunMeta),
+             MPI_BYTE, 0, MPI_COMM_WORLD);
+  if (mpiRank == 0) {
+    RunMeta norm = combineMeta(metas);
+    TFile* nfile = TFile::Open("main777norm.root", "RECREATE");
+    if (!nfile || nfile->IsZombie()) {
+      cout << "Error: cannot open main777norm.root" << endl;
+      return 1;
+    }
+    writeMeta(nfile, metas);
+    writeMeta(nfile, norm, "norm");
+    nfile -> Close();
+    cout << scientific << setprecision(6)
+         << "\n All " << mpiSize << " ranks:\n"
+         << "\t Minimal shower weight     = " << wminAll << "\n"
+         << "\t Maximal shower weight     = " << wmaxAll << "\n"
+         << "\t Mean shower weight        = " << norm.sumW / norm.nAccept
+         << "\n"
+         << "\t Cross section estimate    = " << norm.sigma
+         << " +- " << norm.error << " mb\n"
+         << "\t Event normalization       = sigma * wt / sumW = "
+         << norm.sigma / norm.sumW << " * wt mb" << endl;
+  }
+#endif
+
+  // A completed run leaves nothing to resume.
+  if (st.rndmFile != "") {
+    remove((ckptName + ".root").c_str());
+    remove(st.rndmFile.c_str());
+  }
   
   // Draw and write histograms to file
   TApplication theApp("hist", &argc, argv);
-  TFile *histfile = TFile::Open("main777hist.root", "RECREATE");
-  TCanvas *c1 = new TCanvas ("c1");
+  TFile *histfile = TFile::Open(histFile.c_str(), "RECREATE");
   histWT -> SetAxisRange(wmin - abs(wmax) / 10, wmax + abs(wmin) / 10, "X");
-  histWT -> Draw();
-  gPad   -> SetGridy();
-  gPad   -> SetLogy();
-  gPad   -> WaitPrimitive();
+  // Forked workers and MPI ranks only write, several windows at once would
+  // be of no use.
+  if (iWorker < 0) {
+    TCanvas *c1 = new TCanvas ("c1");
+    histWT -> Draw();
+    gPad   -> SetGridy();
+    gPad   -> SetLogy();
+    gPad   -> WaitPrimitive();
+  }
   histWT -> Write();
   histfile -> Close();
 
   return 0;
 }
+
+//============================================================================
+
+#ifdef MAIN777MPI
+
+// A failing rank takes the others down with it, instead of leaving them
+// waiting for it in the final reductions. The worker threads never call
+// MPI, so MPI_THREAD_FUNNELED is enough.
+int main( int argc, char* argv[] ){
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  int status = run(argc, argv);
+  if (status != 0) MPI_Abort(MPI_COMM_WORLD, status);
+  MPI_Finalize();
+  return status;
+}
+
+#else
+
+int main( int argc, char* argv[] ){ return run(argc, argv); }
+
+#endif
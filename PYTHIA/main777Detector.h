@@ -0,0 +1,184 @@
+// main777Detector.h: detector-response stage of main777.
+// Author: Stefano Veroni
+// Draws the primary vertex, smears momenta and angles and applies a
+// COMPASS-like geometric acceptance, event by event inside main777.
+// Random numbers come from a counter-based Philox4x32-10 generator: every
+// draw is a pure function of (seed, stream, event, track), so results do
+// not depend on the order in which events or tracks are processed and each
+// thread only needs its own stream number to be reproducible. Tracks are
+// handled in blocks, with the random words, the Gaussians and the smearing
+// in separate passes over arrays; the Philox and smearing passes carry
+// "omp simd" and vectorize when built with -fopenmp-simd (see Makefile).
+
+#ifndef MAIN777DETECTOR_H
+#define MAIN777DETECTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+//==========================================================================
+
+// Philox4x32-10 (Salmon et al., SC11): ten rounds of a keyed bijection
+// on a 128-bit counter, giving four 32-bit random words per call.
+
+class Philox4x32 {
+
+public:
+
+  Philox4x32(uint32_t seed = 0, uint32_t stream = 0) {
+    key[0] = seed; key[1] = stream; }
+
+  // The four words for counter (c0, c1, c2, c3), in place.
+  void operator()(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3)
+    const {
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < 10; ++r) {
+      uint64_t p0 = uint64_t(0xD2511F53u) * c0;
+      uint64_t p1 = uint64_t(0xCD9E8D57u) * c2;
+      c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+      c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+      c1 = uint32_t(p1);
+      c3 = uint32_t(p0);
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+  }
+
+  void operator()(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3,
+    uint32_t out[4]) const {
+    (*this)(c0, c1, c2, c3);
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+  }
+
+  // Uniform in (0,1) from one word, never exactly 0 or 1.
+  static double flat(uint32_t w) { return (w + 0.5) * (1. / 4294967296.); }
+
+  // Two independent standard normals from two words (Box-Muller).
+  static void gauss2(uint32_t w0, uint32_t w1, double& g0, double& g1) {
+    double r   = sqrt(-2. * log(flat(w0)));
+    double phi = 2. * M_PI * flat(w1);
+    g0 = r * cos(phi);
+    g1 = r * sin(phi);
+  }
+
+private:
+
+  uint32_t key[2];
+
+};
+
+//==========================================================================
+
+// Vertex, resolution and acceptance parameters, in cm, GeV and rad.
+
+struct DetectorSetup {
+  double zMin, zMax;        // target cells, uniform vertex in z
+  double sigmaXY;           // beam spot width
+  double sigmaPRel;         // constant part of sigma(p)/p
+  double sigmaPQuad;        // part of sigma(p)/p growing with p, per GeV
+  double sigmaTheta;        // polar angle resolution
+  double sigmaPhi;          // azimuthal angle resolution
+  double thetaMax;          // spectrometer opening angle
+  double pMinLepton;        // minimal momentum of the scattered lepton
+  double pMinHadron;        // minimal momentum of a hadron
+};
+
+//==========================================================================
+
+// The detector stage. Tracks are passed as arrays (one per quantity) and
+// handled in one batch per event. The Philox key is (seed, stream); main777
+// uses Main777:detectorSeed and the job's Random:seed, so that separately
+// seeded jobs do not share their detector random numbers.
+
+class DetectorStage {
+
+public:
+
+  DetectorStage(const DetectorSetup& setupIn, uint32_t seed,
+    uint32_t stream = 0) : setup(setupIn), rng(seed, stream) {}
+
+  // Primary vertex of event iEvent; x and y independent of each other.
+  void vertex(uint32_t iEvent, float& x, float& y, float& z) const {
+    uint32_t w[4];
+    rng(iEvent, 0, 0, 0, w);
+    double gx, gy;
+    Philox4x32::gauss2(w[0], w[1], gx, gy);
+    x = setup.sigmaXY * gx;
+    y = setup.sigmaXY * gy;
+    z = setup.zMin + (setup.zMax - setup.zMin) * Philox4x32::flat(w[2]);
+  }
+
+  // Smear n tracks of event iEvent, numbered from iFirst on, and flag the
+  // accepted ones. The track number keeps each track's random numbers
+  // independent of how many tracks are in the batch. Angles phi are in
+  // [-pi, pi], and so stay the smeared ones, folded back once.
+  void smear(uint32_t iEvent, uint32_t iFirst, int n, double pMin,
+    const float* p, const float* theta, const float* phi,
+    float* pDet, float* thetaDet, float* phiDet, int* acc) const {
+    // Single precision, as the results, so that all passes run on the
+    // same number of lanes.
+    const float sigPRel2  = setup.sigmaPRel * setup.sigmaPRel;
+    const float sigPQuad2 = setup.sigmaPQuad * setup.sigmaPQuad;
+    const float sigTheta  = setup.sigmaTheta;
+    const float sigPhi    = setup.sigmaPhi;
+    const float thetaMax  = setup.thetaMax;
+    const float pMinF     = pMin;
+    const float pi        = M_PI;
+    for (int i0 = 0; i0 < n; i0 += nBlock) {
+      int m = std::min(n - i0, int(nBlock));
+      uint32_t w0[nBlock], w1[nBlock], w2[nBlock], w3[nBlock];
+      float    g0[nBlock], g1[nBlock], g2[nBlock];
+      #pragma omp simd
+      for (int k = 0; k < m; ++k) {
+        uint32_t c0 = iEvent, c1 = iFirst + i0 + k, c2 = 1, c3 = 0;
+        rng(c0, c1, c2, c3);
+        w0[k] = c0; w1[k] = c1; w2[k] = c2; w3[k] = c3;
+      }
+      // Box-Muller, of the second pair only the first normal is needed.
+      for (int k = 0; k < m; ++k) {
+        double gA, gB;
+        Philox4x32::gauss2(w0[k], w1[k], gA, gB);
+        g0[k] = gA;
+        g1[k] = gB;
+        g2[k] = sqrt(-2. * log(Philox4x32::flat(w2[k])))
+              * cos(2. * M_PI * Philox4x32::flat(w3[k]));
+      }
+      const float* pB        = p + i0;
+      const float* thetaB    = theta + i0;
+      const float* phiB      = phi + i0;
+      float*       pDetB     = pDet + i0;
+      float*       thetaDetB = thetaDet + i0;
+      float*       phiDetB   = phiDet + i0;
+      int*         accB      = acc + i0;
+      #pragma omp simd
+      for (int k = 0; k < m; ++k) {
+        float sigP = std::sqrt(sigPRel2 + sigPQuad2 * pB[k] * pB[k]);
+        float pS   = pB[k] * (1.f + sigP * g0[k]);
+        float thS  = std::fabs(thetaB[k] + sigTheta * g1[k]);
+        float phS  = phiB[k] + sigPhi * g2[k];
+        phS += phS >  pi ? -2.f * pi : 0.f;
+        phS += phS < -pi ?  2.f * pi : 0.f;
+        pDetB[k]     = pS;
+        thetaDetB[k] = thS;
+        phiDetB[k]   = phS;
+        accB[k]      = (thS < thetaMax) & (pS > pMinF);
+      }
+    }
+  }
+
+  const DetectorSetup& parameters() const { return setup; }
+
+private:
+
+  // Tracks per block, kept on the stack.
+  enum { nBlock = 64 };
+
+  DetectorSetup setup;
+  Philox4x32    rng;
+
+};
+
+//==========================================================================
+
+#endif // MAIN777DETECTOR_H
@@ -0,0 +1,307 @@
+// main777Float16.h: reduced-precision storage of bounded dis tree branches.
+// Author: Stefano Veroni
+// Angles, z and y have a known range and a useful resolution far coarser
+// than a float, so they may be written as ROOT Float16_t (leaf type "f",
+// ROOT 6.20 or later). Each entry of Main777:float16Branches reads
+//   name:xmin:xmax:nbits   the range [xmin, xmax] in 2^nbits steps (values
+//                          outside are clipped, NaN is lost), or
+//   name:nbits             the exponent and nbits bits of mantissa (keeps
+//                          NaN and Inf, for branches unset in some events).
+// ROOT writes a range-packed value as a 4-byte integer, as large as the
+// float, so the range form saves space only where the coarser values
+// compress better; the mantissa form writes 3 bytes (exponent byte and
+// 16-bit mantissa) and is the default. In memory the branches stay float:
+// only what goes to disk changes.
+// Float16Report repeats ROOT's packing on every value written and keeps
+// the largest error per branch, printed and written as tree "float16";
+// main777 carries it over checkpoints, so a resumed run reports all the
+// events of the tree.
+
+#ifndef MAIN777FLOAT16_H
+#define MAIN777FLOAT16_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "main777Table.h"
+
+//==========================================================================
+
+struct Float16Spec {
+  std::string name;
+  double xmin, xmax;       // equal when only the mantissa is truncated
+  int    nbits;
+
+  bool ranged() const { return xmin < xmax; }
+
+  // Range in the leaf type, as in "theha[HadNb]/f[0,3.1416,14]".
+  std::string leafRange() const {
+    char buf[80];
+    if (ranged()) snprintf(buf, sizeof(buf), "[%.9g,%.9g,%d]",
+      xmin, xmax, nbits);
+    else snprintf(buf, sizeof(buf), "[0,0,%d]", nbits);
+    return buf;
+  }
+
+  // The value ROOT reads back for x (TBufferFile::Write/ReadFloat16); in
+  // the range form xmin for NaN, which ROOT leaves undefined.
+  float quantize(float x) const {
+    if (ranged()) {
+      double factor = (nbits < 32 ? double(1u << nbits) : 4294967295.)
+                    / (xmax - xmin);
+      double v = x;
+      if (!(v >= xmin)) v = xmin;    // NaN as well
+      if (v > xmax) v = xmax;
+      unsigned int i = (unsigned int)(0.5 + factor * (v - xmin));
+      return float(i / factor + xmin);
+    }
+    unsigned int u;
+    memcpy(&u, &x, sizeof(u));
+    unsigned int theExp = (u >> 23) & 0xff;
+    unsigned int theMan = ((1u << (nbits + 1)) - 1) & (u >> (23 - nbits - 1));
+    ++theMan;
+    theMan >>= 1;
+    if (theMan & (1u << nbits)) theMan = (1u << nbits) - 1;
+    u = (theExp << 23) | ((theMan & ((1u << (nbits + 1)) - 1)) << (23 - nbits));
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return x < 0 ? -f : f;
+  }
+};
+
+// Read the "name:nbits" and "name:xmin:xmax:nbits" entries; false (with
+// the offending entry in bad) if one cannot be used.
+inline bool parseFloat16(const std::vector<std::string>& entries,
+  std::vector<Float16Spec>& specs, std::string& bad) {
+  specs.clear();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const std::string& e = entries[i];
+    if (e.find_first_not_of(" ") == std::string::npos) continue;
+    std::vector<std::string> f;
+    for (size_t b = 0, c; ; b = c + 1) {
+      c = e.find(':', b);
+      f.push_back(e.substr(b, c == std::string::npos ? c : c - b));
+      if (c == std::string::npos) break;
+    }
+    Float16Spec s;
+    size_t b = f[0].find_first_not_of(" ");
+    if (b == std::string::npos) { bad = e; return false; }
+    s.name = f[0].substr(b, f[0].find_last_not_of(" ") + 1 - b);
+    s.xmin = s.xmax = 0.;
+    if (f.size() == 2) {
+      s.nbits = atoi(f[1].c_str());
+      // ROOT keeps 2 to 14 bits of mantissa.
+      if (s.nbits < 2 || s.nbits > 14) { bad = e; return false; }
+    }
+    else if (f.size() == 4) {
+      s.xmin  = atof(f[1].c_str());
+      s.xmax  = atof(f[2].c_str());
+      s.nbits = atoi(f[3].c_str());
+      if (!(s.xmin < s.xmax) || s.nbits < 2 || s.nbits > 32) {
+        bad = e; return false; }
+    }
+    else { bad = e; return false; }
+    specs.push_back(s);
+  }
+  return true;
+}
+
+//==========================================================================
+
+// Largest quantization error per branch. The branches are watched where
+// the tree reads them from, check() goes over the values about to be
+// filled; only the thread filling the tree may call it.
+
+class Float16Report {
+
+public:
+
+  Float16Report() {}
+
+  Float16Report(const std::vector<Float16Spec>& specsIn) : specs(specsIn),
+    stats(specsIn.size()), values(specsIn.size(), 0),
+    counts(specsIn.size(), 0), booked(specsIn.size(), 0) {}
+
+  bool empty() const { return specs.empty(); }
+
+  // Spec of branch name, 0 if it stays float.
+  const Float16Spec* find(const std::string& name) const {
+    for (size_t i = 0; i < specs.size(); ++i)
+      if (specs[i].name == name) return &specs[i];
+    return 0;
+  }
+
+  // Spec belongs to a float branch of the tree, booked or left out.
+  void book(const Float16Spec* spec) { booked[spec - &specs[0]] = 1; }
+
+  // The branch of spec reads *count values (one if count is 0) at v.
+  void watch(const Float16Spec* spec, const float* v, const int* count) {
+    size_t i = spec - &specs[0];
+    booked[i] = 1;
+    values[i] = v;
+    counts[i] = count;
+  }
+
+  // False, with the name in bad, if a spec is for no float branch.
+  bool allBooked(std::string& bad) const {
+    for (size_t i = 0; i < specs.size(); ++i)
+      if (!booked[i]) { bad = specs[i].name; return false; }
+    return true;
+  }
+
+  void check() {
+    for (size_t i = 0; i < specs.size(); ++i) {
+      if (!values[i]) continue;
+      int n = counts[i] ? *counts[i] : 1;
+      Stat& st = stats[i];
+      for (int k = 0; k < n; ++k) {
+        float x = values[i][k];
+        ++st.n;
+        if (std::isnan(x)) {
+          if (specs[i].ranged() || !std::isnan(specs[i].quantize(x)))
+            ++st.nNaN;
+          continue;
+        }
+        float q = specs[i].quantize(x);
+        if (specs[i].ranged() && (x < specs[i].xmin || x > specs[i].xmax))
+          ++st.nClip;
+        double err = fabs(double(q) - x);
+        if (err > st.maxAbs) st.maxAbs = err;
+        if (x != 0. && err / fabs(x) > st.maxRel) st.maxRel = err / fabs(x);
+      }
+    }
+  }
+
+  // Add the errors of other, as read from a checkpoint, to the branches
+  // with the same spec; false if one of other's differs or is missing.
+  bool add(const Float16Report& other) {
+    bool same = true;
+    for (size_t j = 0; j < other.specs.size(); ++j) {
+      const Float16Spec& o = other.specs[j];
+      const Float16Spec* s = find(o.name);
+      if (!s || s->xmin != o.xmin || s->xmax != o.xmax
+        || s->nbits != o.nbits) { same = false; continue; }
+      Stat& st = stats[s - &specs[0]];
+      const Stat& so = other.stats[j];
+      st.n     += so.n;
+      st.nClip += so.nClip;
+      st.nNaN  += so.nNaN;
+      if (so.maxAbs > st.maxAbs) st.maxAbs = so.maxAbs;
+      if (so.maxRel > st.maxRel) st.maxRel = so.maxRel;
+    }
+    return same;
+  }
+
+  // Table of the watched branches; false if a value was clipped or a NaN
+  // lost, i.e. the declared range does not hold.
+  bool print() const {
+    bool ok = true;
+    std::cout << "\n Float16 branches:\n"
+              << "    branch        range / mantissa bits       values"
+              << "    max abs error  max rel error  clipped  NaN lost"
+              << std::endl;
+    for (size_t i = 0; i < specs.size(); ++i) {
+      if (!values[i] && stats[i].n == 0) continue;
+      const Float16Spec& s = specs[i];
+      const Stat& st = stats[i];
+      std::string range = s.ranged() ? s.leafRange()
+        : "mantissa " + std::to_string(s.nbits);
+      std::cout << "    " << std::left << std::setw(12) << s.name
+                << std::setw(26) << range << std::right
+                << std::setw(12) << st.n << std::scientific
+                << std::setprecision(3) << std::setw(17) << st.maxAbs
+                << std::setw(15) << st.maxRel << std::fixed
+                << std::setw(9) << st.nClip << std::setw(10) << st.nNaN
+                << std::endl;
+      if (st.nClip > 0 || st.nNaN > 0) ok = false;
+    }
+    if (!ok) std::cout << "Warning: values outside the declared float16"
+                       << " ranges were changed" << std::endl;
+    return ok;
+  }
+
+  // One entry per branch with errors, as tree name in dir.
+  void write(TDirectory* dir, const char* name = "float16") const {
+    char     branch[64];
+    double   xmin, xmax, maxAbs, maxRel;
+    Int_t    nbits;
+    Long64_t n, nClip, nNaN;
+    writeTable(dir, name, "main777 float16 quantization errors",
+      [&](TTree* t) {
+      t->Branch("branch",  branch , "branch/C" );
+      t->Branch("xmin"  , &xmin   , "xmin/D"   );
+      t->Branch("xmax"  , &xmax   , "xmax/D"   );
+      t->Branch("nbits" , &nbits  , "nbits/I"  );
+      t->Branch("n"     , &n      , "n/L"      );
+      t->Branch("maxAbs", &maxAbs , "maxAbs/D" );
+      t->Branch("maxRel", &maxRel , "maxRel/D" );
+      t->Branch("nClip" , &nClip  , "nClip/L"  );
+      t->Branch("nNaN"  , &nNaN   , "nNaN/L"   );
+      for (size_t i = 0; i < specs.size(); ++i) {
+        if (!values[i] && stats[i].n == 0) continue;
+        snprintf(branch, sizeof(branch), "%s", specs[i].name.c_str());
+        xmin   = specs[i].xmin;
+        xmax   = specs[i].xmax;
+        nbits  = specs[i].nbits;
+        n      = stats[i].n;
+        maxAbs = stats[i].maxAbs;
+        maxRel = stats[i].maxRel;
+        nClip  = stats[i].nClip;
+        nNaN   = stats[i].nNaN;
+        t->Fill();
+      }
+    });
+  }
+
+  // Read what write() wrote, for add(); false if it is not there.
+  bool read(TDirectory* dir, const char* name = "float16") {
+    char     branch[64];
+    Float16Spec s;
+    Stat     st;
+    Float16Report r;
+    if (!readTable(dir, name, [&](TTree* t) {
+      t->SetBranchAddress("branch", branch   );
+      t->SetBranchAddress("xmin"  , &s.xmin  );
+      t->SetBranchAddress("xmax"  , &s.xmax  );
+      t->SetBranchAddress("nbits" , &s.nbits );
+      t->SetBranchAddress("n"     , &st.n    );
+      t->SetBranchAddress("maxAbs", &st.maxAbs);
+      t->SetBranchAddress("maxRel", &st.maxRel);
+      t->SetBranchAddress("nClip" , &st.nClip);
+      t->SetBranchAddress("nNaN"  , &st.nNaN );
+    }, [&]() {
+      s.name = branch;
+      r.specs.push_back(s);
+      r.stats.push_back(st);
+      r.values.push_back(0);
+      r.counts.push_back(0);
+      r.booked.push_back(0);
+      return true; })) return false;
+    *this = r;
+    return true;
+  }
+
+private:
+
+  struct Stat {
+    Stat() : n(0), nClip(0), nNaN(0), maxAbs(0.), maxRel(0.) {}
+    Long64_t n, nClip, nNaN;
+    double   maxAbs, maxRel;
+  };
+
+  std::vector<Float16Spec>  specs;
+  std::vector<Stat>         stats;
+  std::vector<const float*> values;
+  std::vector<const int*>   counts;
+  std::vector<char>         booked;
+
+};
+
+//==========================================================================
+
+#endif // MAIN777FLOAT16_H
@@ -0,0 +1,243 @@
+// main777Index.h: kinematic-bin index of the dis tree of main777.
+// Author: Stefano Veroni
+// A sidecar file next to the tree file (main777index.root next to
+// main777tree.root) lists, for coarse bins of xbj, Q2, y and W, the ranges
+// of consecutive tree entries falling into each bin. A binned analysis
+// then reads only those entries instead of scanning the whole tree:
+//   KinIndex index;
+//   index.read(indexFile);
+//   vector<int> bins = index.bins(0.01, 0.03, 1., 3.);  // x and Q2 ranges
+//   TEntryList* list = index.apply(tree, bins);   // tree->SetEntryList
+//   ... loop over the tree ...
+//   tree->SetEntryList(0); delete list;
+// or loops over index.ranges(bins) itself. Bins are coarse: the entries
+// of a bin are the candidates, the analysis still applies its own cuts.
+// The index is made after the tree is written, with one pass over the
+// four branches. main777 can sort the events by bin within each cluster
+// while writing (Main777:indexSort), which turns the entries of a bin into
+// one range per cluster; in generation order, the default, nearly every
+// entry is a range of its own and the index only records the bins.
+
+#ifndef MAIN777INDEX_H
+#define MAIN777INDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TBranch.h"
+#include "TEntryList.h"
+#include "main777Table.h"
+
+//==========================================================================
+
+class KinIndex {
+
+public:
+
+  // Binning variables, as named in the dis tree.
+  enum { iX, iQ2, iY, iW, nDim };
+
+  KinIndex() : nBin(0), nEntries(0) {}
+
+  KinIndex(const std::vector<double> edgesIn[nDim]) : nEntries(0) {
+    init(edgesIn); }
+
+  // Bin edges per variable, increasing; an empty vector leaves the
+  // variable out. Values outside the edges (or NaN) belong to no bin.
+  void init(const std::vector<double> edgesIn[nDim]) {
+    nBin = 1;
+    for (int d = 0; d < nDim; ++d) {
+      edges[d] = edgesIn[d];
+      if (edges[d].size() > 1) nBin *= edges[d].size() - 1;
+    }
+    runs.clear();
+  }
+
+  bool empty() const { return nBin == 0; }
+
+  // Bin of an event, -1 outside.
+  int bin(double x, double Q2, double y, double W) const {
+    double v[nDim] = {x, Q2, y, W};
+    int b = 0;
+    for (int d = 0; d < nDim; ++d) {
+      const std::vector<double>& e = edges[d];
+      if (e.size() < 2) continue;
+      if (!(v[d] >= e.front() && v[d] < e.back())) return -1;
+      b = b * (e.size() - 1)
+        + (std::upper_bound(e.begin(), e.end(), v[d]) - e.begin() - 1);
+    }
+    return nBin > 0 ? b : -1;
+  }
+
+  // All bins overlapping the ranges [lo, hi) of x, Q2, y and W; the
+  // default ranges take everything.
+  std::vector<int> bins(double xLo = -HUGE_VAL, double xHi = HUGE_VAL,
+    double Q2Lo = -HUGE_VAL, double Q2Hi = HUGE_VAL,
+    double yLo = -HUGE_VAL, double yHi = HUGE_VAL,
+    double WLo = -HUGE_VAL, double WHi = HUGE_VAL) const {
+    double lo[nDim] = {xLo, Q2Lo, yLo, WLo};
+    double hi[nDim] = {xHi, Q2Hi, yHi, WHi};
+    std::vector<int> sel(1, 0);
+    for (int d = 0; d < nDim; ++d) {
+      const std::vector<double>& e = edges[d];
+      if (e.size() < 2) continue;
+      std::vector<int> next;
+      for (size_t s = 0; s < sel.size(); ++s)
+        for (size_t i = 0; i + 1 < e.size(); ++i)
+          if (e[i] < hi[d] && e[i + 1] > lo[d])
+            next.push_back(sel[s] * (e.size() - 1) + i);
+      sel.swap(next);
+    }
+    return nBin > 0 ? sel : std::vector<int>();
+  }
+
+  // Index the entries of tree, reading only its xbj, Q2, y and W branches;
+  // false if one is missing. The branch addresses are restored after.
+  bool build(TTree* tree) {
+    const char* name[nDim] = {"xbj", "Q2", "y", "W"};
+    TBranch* br[nDim];
+    char*    old[nDim];
+    float    v[nDim];
+    for (int d = 0; d < nDim; ++d) {
+      br[d] = tree->GetBranch(name[d]);
+      if (!br[d]) return false;
+    }
+    for (int d = 0; d < nDim; ++d) {
+      old[d] = br[d]->GetAddress();
+      br[d]->SetAddress(&v[d]);
+    }
+    runs.clear();
+    nEntries = tree->GetEntries();
+    Run run = {-1, 0, 0};
+    for (Long64_t i = 0; i < nEntries; ++i) {
+      for (int d = 0; d < nDim; ++d) br[d]->GetEntry(i);
+      int b = bin(v[iX], v[iQ2], v[iY], v[iW]);
+      if (b == run.bin && i == run.end) { ++run.end; continue; }
+      if (run.bin >= 0) runs.push_back(run);
+      run.bin = b; run.first = i; run.end = i + 1;
+    }
+    if (run.bin >= 0) runs.push_back(run);
+    for (int d = 0; d < nDim; ++d) br[d]->SetAddress(old[d]);
+    return true;
+  }
+
+  // Entry ranges [first, end) of the given bins, in entry order.
+  std::vector<std::pair<Long64_t,Long64_t> > ranges(
+    const std::vector<int>& sel) const {
+    std::vector<char> want(nBin, 0);
+    for (size_t s = 0; s < sel.size(); ++s)
+      if (sel[s] >= 0 && sel[s] < nBin) want[sel[s]] = 1;
+    std::vector<std::pair<Long64_t,Long64_t> > r;
+    for (size_t i = 0; i < runs.size(); ++i) {
+      if (!want[runs[i].bin]) continue;
+      if (!r.empty() && r.back().second == runs[i].first)
+        r.back().second = runs[i].end;
+      else r.push_back(std::make_pair(runs[i].first, runs[i].end));
+    }
+    return r;
+  }
+
+  // Restrict tree to the entries of the given bins with a new entry list,
+  // replacing an older one; 0 if the index was made for a tree of another
+  // size. The tree does not own the list: the caller deletes it, after
+  // tree->SetEntryList(0) or together with the tree.
+  TEntryList* apply(TTree* tree, const std::vector<int>& sel) const {
+    if (tree->GetEntries() != nEntries) return 0;
+    std::vector<std::pair<Long64_t,Long64_t> > r = ranges(sel);
+    TEntryList* list = new TEntryList(tree);
+    for (size_t i = 0; i < r.size(); ++i)
+      for (Long64_t e = r[i].first; e < r[i].second; ++e)
+        list->Enter(e);
+    tree->SetEntryList(list);
+    return list;
+  }
+
+  // Ranges and distinct bins in the index.
+  size_t nRuns() const { return runs.size(); }
+  int    nBinsUsed() const {
+    std::vector<char> used(nBin, 0);
+    for (size_t i = 0; i < runs.size(); ++i) used[runs[i].bin] = 1;
+    return std::count(used.begin(), used.end(), 1);
+  }
+
+  // The binning as tree name + "Bins" and one entry per range as tree
+  // name in dir.
+  void write(TDirectory* dir, const char* name = "index") const {
+    std::string nameBins = std::string(name) + "Bins";
+    std::vector<double>* e[nDim];
+    for (int d = 0; d < nDim; ++d) e[d] = const_cast<std::vector<double>*>(
+      &edges[d]);
+    Long64_t n = nEntries;
+    writeTable(dir, nameBins.c_str(), "main777 index binning", [&](TTree* t) {
+      t->Branch("x"       ,&e[iX] );
+      t->Branch("Q2"      ,&e[iQ2]);
+      t->Branch("y"       ,&e[iY] );
+      t->Branch("W"       ,&e[iW] );
+      t->Branch("nEntries",&n     ,"nEntries/L");
+      t->Fill();
+    });
+    Run run;
+    writeTable(dir, name, "main777 index ranges", [&](TTree* t) {
+      t->Branch("bin"  ,&run.bin  ,"bin/I"  );
+      t->Branch("first",&run.first,"first/L");
+      t->Branch("end"  ,&run.end  ,"end/L"  );
+      for (size_t i = 0; i < runs.size(); ++i) {
+        run = runs[i];
+        t->Fill();
+      }
+    });
+  }
+
+  // Read what write() wrote; false if it is not there.
+  bool read(TDirectory* dir, const char* name = "index") {
+    std::string nameBins = std::string(name) + "Bins";
+    std::vector<double>* e[nDim] = {0, 0, 0, 0};
+    Long64_t n = 0;
+    bool     got = false;
+    readTable(dir, nameBins.c_str(), [&](TTree* t) {
+      t->SetBranchAddress("x"       ,&e[iX] );
+      t->SetBranchAddress("Q2"      ,&e[iQ2]);
+      t->SetBranchAddress("y"       ,&e[iY] );
+      t->SetBranchAddress("W"       ,&e[iW] );
+      t->SetBranchAddress("nEntries",&n     );
+    }, [&]() { got = true; return false; });
+    std::vector<double> edgesIn[nDim];
+    for (int d = 0; d < nDim; ++d) {
+      if (e[d]) edgesIn[d] = *e[d];
+      delete e[d];
+    }
+    if (!got) return false;
+    init(edgesIn);
+    nEntries = n;
+    Run run;
+    if (readTable(dir, name, [&](TTree* t) {
+      t->SetBranchAddress("bin"  ,&run.bin  );
+      t->SetBranchAddress("first",&run.first);
+      t->SetBranchAddress("end"  ,&run.end  );
+    }, [&]() {
+      if (run.bin >= 0 && run.bin < nBin) runs.push_back(run);
+      return true; })) return true;
+    *this = KinIndex();
+    return false;
+  }
+
+private:
+
+  // Consecutive entries [first, end) of one bin.
+  struct Run {
+    Int_t    bin;
+    Long64_t first, end;
+  };
+
+  int      nBin;
+  Long64_t nEntries;
+  std::vector<double> edges[nDim];
+  std::vector<Run>    runs;
+
+};
+
+//==========================================================================
+
+#endif // MAIN777INDEX_H
@@ -0,0 +1,91 @@
+// main777Meta.h: run metadata stored next to the dis tree of main777.
+// Author: Stefano Veroni
+// Every main777 job writes one entry to a "meta" tree in its tree file:
+// cross section estimate, weight sums, event counts and random seed. A
+// merged file keeps one entry per job in "meta" and the combined numbers
+// in "norm", so the per-job table travels with the merged sample.
+
+#ifndef MAIN777META_H
+#define MAIN777META_H
+
+#include <cmath>
+#include <vector>
+#include "main777Table.h"
+
+//==========================================================================
+
+struct RunMeta {
+  double   sigma, error;   // cross section estimate and its error (mb)
+  double   sumW, sumW2;    // sum of event weights and of their squares
+  Long64_t nAccept;        // events accepted with non-zero weight
+  Long64_t nEvent;         // events requested
+  Int_t    seed;           // Random:seed of the job, -1 when combined
+};
+
+//==========================================================================
+
+// One entry per job, as tree name in dir.
+inline void writeMeta(TDirectory* dir, const std::vector<RunMeta>& metas,
+  const char* name = "meta") {
+  RunMeta meta;
+  writeTable(dir, name, "main777 run metadata", [&](TTree* t) {
+    t->Branch("sigma"  ,&meta.sigma  ,"sigma/D"  );
+    t->Branch("error"  ,&meta.error  ,"error/D"  );
+    t->Branch("sumW"   ,&meta.sumW   ,"sumW/D"   );
+    t->Branch("sumW2"  ,&meta.sumW2  ,"sumW2/D"  );
+    t->Branch("nAccept",&meta.nAccept,"nAccept/L");
+    t->Branch("nEvent" ,&meta.nEvent ,"nEvent/L" );
+    t->Branch("seed"   ,&meta.seed   ,"seed/I"   );
+    for (size_t i = 0; i < metas.size(); ++i) {
+      meta = metas[i];
+      t->Fill();
+    }
+  });
+}
+
+inline void writeMeta(TDirectory* dir, const RunMeta& m,
+  const char* name = "meta") {
+  writeMeta(dir, std::vector<RunMeta>(1, m), name);
+}
+
+// Append the entries of tree name in dir to metas; false if there is none.
+inline bool readMeta(TDirectory* dir, std::vector<RunMeta>& metas,
+  const char* name = "meta") {
+  RunMeta meta;
+  return readTable(dir, name, [&](TTree* t) {
+    t->SetBranchAddress("sigma"  ,&meta.sigma  );
+    t->SetBranchAddress("error"  ,&meta.error  );
+    t->SetBranchAddress("sumW"   ,&meta.sumW   );
+    t->SetBranchAddress("sumW2"  ,&meta.sumW2  );
+    t->SetBranchAddress("nAccept",&meta.nAccept);
+    t->SetBranchAddress("nEvent" ,&meta.nEvent );
+    t->SetBranchAddress("seed"   ,&meta.seed   );
+  }, [&]() { metas.push_back(meta); return true; });
+}
+
+// Combine jobs: sums for weights and counts, cross sections averaged with
+// the accepted events as weights and errors added in quadrature alike.
+// An event of the combined sample then carries sigma * wt / sumW.
+inline RunMeta combineMeta(const std::vector<RunMeta>& metas) {
+  RunMeta c = RunMeta();
+  double err2 = 0.;
+  for (size_t i = 0; i < metas.size(); ++i) {
+    const RunMeta& m = metas[i];
+    c.sigma   += m.nAccept * m.sigma;
+    err2      += pow(m.nAccept * m.error, 2);
+    c.sumW    += m.sumW;
+    c.sumW2   += m.sumW2;
+    c.nAccept += m.nAccept;
+    c.nEvent  += m.nEvent;
+  }
+  if (c.nAccept > 0) {
+    c.sigma /= c.nAccept;
+    c.error  = sqrt(err2) / c.nAccept;
+  }
+  c.seed = -1;
+  return c;
+}
+
+//==========================================================================
+
+#endif // MAIN777META_H
@@ -0,0 +1,232 @@
+// main777Moments.h: binned azimuthal moments accumulated inside main777.
+// Author: Stefano Veroni
+// Instead of writing every hadron to the tree and computing the moments
+// of the azimuthal distributions afterwards, the weighted sums are made
+// while generating, in bins of x, Q2, z and pT. Per bin it keeps the
+// number of hadrons, sum w, sum w^2 and, for each moment f,
+// sum w f, sum w^2 f and sum w^2 f^2, which is all that is needed for the
+// moment <f> = sum w f / sum w and its statistical error. Accumulators
+// with the same binning add up, so each thread and each job keeps its own
+// and they are merged at the end (main777, main778).
+
+#ifndef MAIN777MOMENTS_H
+#define MAIN777MOMENTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "main777Table.h"
+
+//==========================================================================
+
+class MomentAccumulator {
+
+public:
+
+  // Binning variables and moments.
+  enum { iX, iQ2, iZ, iPT, nDim };
+  enum { SinPhiH, CosPhiH, SinPhiHmS, CosPhiHmS, nMom };
+
+  MomentAccumulator() : nBin(0) {}
+
+  MomentAccumulator(const std::vector<double> edgesIn[nDim]) { init(edgesIn); }
+
+  // Bin edges per variable, increasing; values outside are not counted.
+  void init(const std::vector<double> edgesIn[nDim]) {
+    nBin = 1;
+    for (int d = 0; d < nDim; ++d) {
+      edges[d] = edgesIn[d];
+      nBin *= std::max(int(edges[d].size()) - 1, 0);
+    }
+    n    .assign(nBin, 0);
+    sumW .assign(nBin, 0.);
+    sumW2.assign(nBin, 0.);
+    sumWF  .assign(nBin * nMom, 0.);
+    sumW2F .assign(nBin * nMom, 0.);
+    sumW2F2.assign(nBin * nMom, 0.);
+  }
+
+  // No binning yet.
+  bool empty() const { return nBin == 0; }
+
+  // One hadron with azimuthal angles phiH and phiS (GNS) and weight w.
+  void fill(double x, double Q2, double z, double pT,
+    double phiH, double phiS, double w) {
+    if (nBin == 0) return;
+    double v[nDim] = {x, Q2, z, pT};
+    int bin = 0;
+    for (int d = 0; d < nDim; ++d) {
+      const std::vector<double>& e = edges[d];
+      if (!(v[d] >= e.front() && v[d] < e.back())) return;
+      bin = bin * (e.size() - 1)
+          + (std::upper_bound(e.begin(), e.end(), v[d]) - e.begin() - 1);
+    }
+    double f[nMom] = { sin(phiH), cos(phiH),
+                       sin(phiH - phiS), cos(phiH - phiS) };
+    n[bin]     += 1;
+    sumW[bin]  += w;
+    sumW2[bin] += w * w;
+    for (int k = 0; k < nMom; ++k) {
+      sumWF  [bin * nMom + k] += w * f[k];
+      sumW2F [bin * nMom + k] += w * w * f[k];
+      sumW2F2[bin * nMom + k] += w * w * f[k] * f[k];
+    }
+  }
+
+  // Add the sums of other; false if the binnings differ.
+  bool add(const MomentAccumulator& other) {
+    if (other.empty()) return true;
+    if (empty()) { *this = other; return true; }
+    for (int d = 0; d < nDim; ++d)
+      if (edges[d] != other.edges[d]) return false;
+    for (int b = 0; b < nBin; ++b) {
+      n[b]     += other.n[b];
+      sumW[b]  += other.sumW[b];
+      sumW2[b] += other.sumW2[b];
+    }
+    for (int i = 0; i < nBin * nMom; ++i) {
+      sumWF[i]   += other.sumWF[i];
+      sumW2F[i]  += other.sumW2F[i];
+      sumW2F2[i] += other.sumW2F2[i];
+    }
+    return true;
+  }
+
+  // Moment k in bin b and its error,
+  // var = sum w^2 (f - <f>)^2 / (sum w)^2.
+  double moment(int b, int k, double& err) const {
+    if (sumW[b] == 0.) { err = 0.; return 0.; }
+    int i = b * nMom + k;
+    double m   = sumWF[i] / sumW[b];
+    double var = sumW2F2[i] - 2. * m * sumW2F[i] + m * m * sumW2[b];
+    err = sqrt(std::max(var, 0.)) / fabs(sumW[b]);
+    return m;
+  }
+
+  // One entry per bin, empty ones included, as tree name in dir. Each
+  // entry carries its bin edges, so no binning is needed to read it back.
+  void write(TDirectory* dir, const char* name = "moments") const {
+    Row r;
+    writeTable(dir, name, "main777 azimuthal moments", [&](TTree* t) {
+      book(t, r, false);
+      for (int b = 0; b < nBin; ++b) {
+        int rest = b;
+        for (int d = nDim - 1; d >= 0; --d) {
+          int nd = edges[d].size() - 1;
+          r.idx[d] = rest % nd;
+          r.lo[d]  = edges[d][r.idx[d]];
+          r.hi[d]  = edges[d][r.idx[d] + 1];
+          rest /= nd;
+        }
+        r.n     = n[b];
+        r.sumW  = sumW[b];
+        r.sumW2 = sumW2[b];
+        for (int k = 0; k < nMom; ++k) {
+          r.sumWF[k]   = sumWF  [b * nMom + k];
+          r.sumW2F[k]  = sumW2F [b * nMom + k];
+          r.sumW2F2[k] = sumW2F2[b * nMom + k];
+        }
+        t->Fill();
+      }
+    });
+  }
+
+  // Add all entries of tree name in dir, which may hold several tables
+  // (as after merging files); without a binning yet it is taken from the
+  // entries. False if there is no table or the binnings differ.
+  bool read(TDirectory* dir, const char* name = "moments") {
+    TTree* t = (TTree*) dir->Get(name);
+    if (!t) return false;
+    Row r;
+    book(t, r, true);
+    Long64_t nRow = t->GetEntries();
+    // Edges from the bins themselves; a mismatch shows up below.
+    if (empty() && nRow > 0) {
+      std::vector<double> e[nDim];
+      for (Long64_t i = 0; i < nRow; ++i) {
+        t->GetEntry(i);
+        for (int d = 0; d < nDim; ++d) {
+          if (int(e[d].size()) < r.idx[d] + 2) e[d].resize(r.idx[d] + 2);
+          e[d][r.idx[d]]     = r.lo[d];
+          e[d][r.idx[d] + 1] = r.hi[d];
+        }
+      }
+      init(e);
+    }
+    for (Long64_t i = 0; i < nRow; ++i) {
+      t->GetEntry(i);
+      int b = 0;
+      for (int d = 0; d < nDim; ++d) {
+        int nd = edges[d].size() - 1;
+        if (r.idx[d] >= nd || edges[d][r.idx[d]] != r.lo[d]
+          || edges[d][r.idx[d] + 1] != r.hi[d]) { delete t; return false; }
+        b = b * nd + r.idx[d];
+      }
+      n[b]     += r.n;
+      sumW[b]  += r.sumW;
+      sumW2[b] += r.sumW2;
+      for (int k = 0; k < nMom; ++k) {
+        sumWF  [b * nMom + k] += r.sumWF[k];
+        sumW2F [b * nMom + k] += r.sumW2F[k];
+        sumW2F2[b * nMom + k] += r.sumW2F2[k];
+      }
+    }
+    delete t;
+    return true;
+  }
+
+private:
+
+  // One table entry.
+  struct Row {
+    Int_t    idx[nDim];
+    double   lo[nDim], hi[nDim];
+    Long64_t n;
+    double   sumW, sumW2, sumWF[nMom], sumW2F[nMom], sumW2F2[nMom];
+  };
+
+  static void book(TTree* t, Row& r, bool reading) {
+    const char*  name[nDim] = {"x", "Q2", "z", "pT"};
+    for (int d = 0; d < nDim; ++d) {
+      std::string i = std::string("i") + name[d];
+      std::string l = std::string(name[d]) + "Lo";
+      std::string h = std::string(name[d]) + "Hi";
+      if (reading) {
+        t->SetBranchAddress(i.c_str(), &r.idx[d]);
+        t->SetBranchAddress(l.c_str(), &r.lo[d]);
+        t->SetBranchAddress(h.c_str(), &r.hi[d]);
+      } else {
+        t->Branch(i.c_str(), &r.idx[d], (i + "/I").c_str());
+        t->Branch(l.c_str(), &r.lo[d],  (l + "/D").c_str());
+        t->Branch(h.c_str(), &r.hi[d],  (h + "/D").c_str());
+      }
+    }
+    if (reading) {
+      t->SetBranchAddress("n"      ,&r.n      );
+      t->SetBranchAddress("sumW"   ,&r.sumW   );
+      t->SetBranchAddress("sumW2"  ,&r.sumW2  );
+      t->SetBranchAddress("sumWF"  , r.sumWF  );
+      t->SetBranchAddress("sumW2F" , r.sumW2F );
+      t->SetBranchAddress("sumW2F2", r.sumW2F2);
+    } else {
+      // Moments: sin phi_h, cos phi_h, sin(phi_h-phi_s), cos(phi_h-phi_s)
+      t->Branch("n"      ,&r.n      ,"n/L"         );
+      t->Branch("sumW"   ,&r.sumW   ,"sumW/D"      );
+      t->Branch("sumW2"  ,&r.sumW2  ,"sumW2/D"     );
+      t->Branch("sumWF"  , r.sumWF  ,"sumWF[4]/D"  );
+      t->Branch("sumW2F" , r.sumW2F ,"sumW2F[4]/D" );
+      t->Branch("sumW2F2", r.sumW2F2,"sumW2F2[4]/D");
+    }
+  }
+
+  int nBin;
+  std::vector<double> edges[nDim];
+  std::vector<Long64_t> n;
+  std::vector<double> sumW, sumW2, sumWF, sumW2F, sumW2F2;
+
+};
+
+//==========================================================================
+
+#endif // MAIN777MOMENTS_H
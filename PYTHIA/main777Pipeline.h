@@ -0,0 +1,248 @@
+// main777Pipeline.h: stage queues for the pipelined mode of main777.
+// Author: Stefano Veroni
+// A bounded lock-free ring buffer between one producer thread and one
+// consumer thread. Slots are allocated once and filled in place: the
+// producer claims the next free slot, writes into it and publishes it, the
+// consumer reads the oldest published slot and releases it. A full buffer
+// holds the producer back (backpressure), an empty one the consumer.
+// Each buffer counts how full it was and how often either side waited.
+// AsyncTreeWriter drains such buffers into a TTree on a thread of its own,
+// so that filling, compression and disk writes stay off the event loop.
+
+#ifndef MAIN777PIPELINE_H
+#define MAIN777PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TROOT.h"
+#include "TTree.h"
+
+//==========================================================================
+
+template<class T> class RingBuffer {
+
+public:
+
+  // The capacity is rounded up to a power of two.
+  RingBuffer(size_t capacityIn) : capacity(1), head(0), tail(0),
+    closed(false), nPush(0), nFull(0), nEmpty(0), maxOcc(0), sumOcc(0.) {
+    while (capacity < capacityIn) capacity *= 2;
+    mask = capacity - 1;
+    slots.resize(capacity);
+  }
+
+  // Producer: next free slot, waiting while the buffer is full.
+  T& claim() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == capacity) {
+      ++nFull;
+      while (t - head.load(std::memory_order_acquire) == capacity)
+        std::this_thread::yield();
+    }
+    return slots[t & mask];
+  }
+
+  // Producer: hand the claimed slot over to the consumer.
+  void publish() {
+    size_t t   = tail.load(std::memory_order_relaxed);
+    size_t occ = t + 1 - head.load(std::memory_order_acquire);
+    ++nPush;
+    sumOcc += occ;
+    if (occ > maxOcc) maxOcc = occ;
+    tail.store(t + 1, std::memory_order_release);
+  }
+
+  // Producer: no more slots will be published.
+  void close() { closed.store(true, std::memory_order_release); }
+
+  // Consumer: oldest published slot, waiting while the buffer is empty
+  // (and calling idle, if given, meanwhile); 0 once the buffer is closed
+  // and drained.
+  T* front(const std::function<void()>& idle = std::function<void()>()) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == h) {
+      ++nEmpty;
+      while (tail.load(std::memory_order_acquire) == h) {
+        if (closed.load(std::memory_order_acquire)
+          && tail.load(std::memory_order_acquire) == h) return 0;
+        if (idle) idle();
+        std::this_thread::yield();
+      }
+    }
+    return &slots[h & mask];
+  }
+
+  // Consumer: give the slot returned by front() back to the producer.
+  void release() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+  // Occupancy and waits, to be called once both sides have finished.
+  void stat(const std::string& name) const {
+    std::cout << std::fixed << std::setprecision(1)
+      << " " << std::left << std::setw(22) << name << std::right
+      << " size " << std::setw(5) << capacity
+      << "  mean fill " << std::setw(7)
+      << (nPush > 0 ? sumOcc / nPush : 0.)
+      << "  max fill " << std::setw(5) << maxOcc
+      << "  producer waits " << std::setw(8) << nFull
+      << "  consumer waits " << std::setw(8) << nEmpty << std::endl;
+  }
+
+private:
+
+  size_t capacity, mask;
+  std::vector<T> slots;
+  // Head and tail on separate cache lines, as each side writes only one.
+  std::atomic<size_t> head;
+  char pad[64];
+  std::atomic<size_t> tail;
+  std::atomic<bool> closed;
+
+  // Written by the producer (nPush, nFull, maxOcc, sumOcc) or the
+  // consumer (nEmpty) only.
+  long   nPush, nFull, nEmpty;
+  size_t maxOcc;
+  double sumOcc;
+
+};
+
+//==========================================================================
+
+// Background writer. Producers fill events in place into slots of the
+// writer's queues (a pool allocated once, so memory stays bounded); the
+// writer thread reads the queues round-robin, copies each event into the
+// object the tree branches point at and fills the tree. With nImt > 0 the
+// baskets are compressed by ROOT's implicit multithreading as well.
+// With sortSize > 0 the writer collects groups of sortSize events and fills
+// each group ordered by sortKey (stable, so events of the same key keep
+// their order); a group is filled early when it has to, at a wait() or at
+// the end. Groups line up with the tree clusters if the tree flushes every
+// sortSize entries. If given, inspect is called with each event just
+// before it is filled, on the writer thread.
+
+template<class T> class AsyncTreeWriter {
+
+public:
+
+  AsyncTreeWriter(TTree* treeIn, T& boundIn, int nQueues, size_t queueSize,
+    int nImt = 0, size_t sortSizeIn = 0,
+    std::function<int(const T&)> sortKeyIn = std::function<int(const T&)>(),
+    std::function<void(const T&)> inspectIn = std::function<void(const T&)>())
+    : tree(treeIn), bound(boundIn), sortSize(sortKeyIn ? sortSizeIn : 0),
+    sortKey(sortKeyIn), inspect(inspectIn), nWritten(0), nWanted(0) {
+    ROOT::EnableThreadSafety();
+    if (nImt > 0) {
+      ROOT::EnableImplicitMT(nImt);
+      tree->SetImplicitMT(true);
+    }
+    for (int i = 0; i < nQueues; ++i)
+      queues.push_back(new RingBuffer<T>(queueSize));
+    writer = std::thread(&AsyncTreeWriter::run, this);
+  }
+
+  ~AsyncTreeWriter() {
+    close();
+    for (size_t i = 0; i < queues.size(); ++i) delete queues[i];
+  }
+
+  // Queue i; queue events in the order the writer reads them: event k of
+  // the run to queue k % nQueues.
+  RingBuffer<T>& queue(int i) { return *queues[i]; }
+
+  // Wait until nEvents events have been filled into the tree.
+  void wait(long nEvents) {
+    long n = nWanted.load(std::memory_order_relaxed);
+    while (n < nEvents && !nWanted.compare_exchange_weak(n, nEvents)) {}
+    while (nWritten.load(std::memory_order_acquire) < nEvents)
+      std::this_thread::yield();
+  }
+
+  // Fill what is left and stop the writer, once all producers are done.
+  void close() {
+    if (!writer.joinable()) return;
+    for (size_t i = 0; i < queues.size(); ++i) queues[i]->close();
+    writer.join();
+  }
+
+private:
+
+  void run() {
+    if (sortSize > 0) { runSorted(); return; }
+    for (size_t i = 0; ; i = (i + 1) % queues.size()) {
+      T* event = queues[i]->front();
+      if (!event) break;
+      bound = *event;
+      queues[i]->release();
+      if (inspect) inspect(bound);
+      tree->Fill();
+      nWritten.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  void runSorted() {
+    std::vector<T>   group;
+    std::vector<int> keys;
+    group.reserve(sortSize);
+    keys.reserve(sortSize);
+    // A group ends where the tree's cluster ends, also after an incomplete
+    // group or entries already in the tree (resumed run).
+    size_t target = sortSize - tree->GetEntries() % sortSize;
+    // While a queue is empty, fill an incomplete group if someone waits.
+    std::function<void()> idle = [&]() {
+      if (!group.empty() && nWanted.load(std::memory_order_acquire)
+        > nWritten.load(std::memory_order_relaxed)) {
+        fillGroup(group, keys);
+        target = sortSize - tree->GetEntries() % sortSize;
+      }
+    };
+    for (size_t i = 0; ; i = (i + 1) % queues.size()) {
+      T* event = queues[i]->front(idle);
+      if (!event) break;
+      group.push_back(*event);
+      queues[i]->release();
+      keys.push_back(sortKey(group.back()));
+      if (group.size() == target) {
+        fillGroup(group, keys);
+        target = sortSize;
+      }
+    }
+    fillGroup(group, keys);
+  }
+
+  void fillGroup(std::vector<T>& group, std::vector<int>& keys) {
+    std::vector<size_t> order(group.size());
+    for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+    std::stable_sort(order.begin(), order.end(),
+      [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+    for (size_t k = 0; k < order.size(); ++k) {
+      bound = group[order[k]];
+      if (inspect) inspect(bound);
+      tree->Fill();
+    }
+    nWritten.fetch_add(group.size(), std::memory_order_release);
+    group.clear();
+    keys.clear();
+  }
+
+  TTree*  tree;
+  T&      bound;
+  size_t  sortSize;
+  std::function<int(const T&)> sortKey;
+  std::function<void(const T&)> inspect;
+  std::vector<RingBuffer<T>*> queues;
+  std::thread       writer;
+  std::atomic<long> nWritten, nWanted;
+
+};
+
+//==========================================================================
+
+#endif // MAIN777PIPELINE_H
@@ -0,0 +1,66 @@
+// main777Table.h: small tables of main777 kept as trees next to the dis tree.
+// Author: Stefano Veroni
+// Run metadata, moments, index and float16 report are each a few entries
+// of plain numbers; writeTable() and readTable() do the ROOT part common
+// to all of them.
+
+#ifndef MAIN777TABLE_H
+#define MAIN777TABLE_H
+
+#include "TDirectory.h"
+#include "TTree.h"
+
+//==========================================================================
+
+// Makes dir the current directory for as long as it lives.
+
+class DirectoryGuard {
+
+public:
+
+  DirectoryGuard(TDirectory* dir) : old(gDirectory) { dir->cd(); }
+  ~DirectoryGuard() { old->cd(); }
+
+private:
+
+  DirectoryGuard(const DirectoryGuard&);
+  DirectoryGuard& operator=(const DirectoryGuard&);
+
+  TDirectory* old;
+
+};
+
+//==========================================================================
+
+// Write tree name to dir, replacing an older one; fill(t) books the
+// branches of the new tree and fills it.
+template<class Fill>
+inline void writeTable(TDirectory* dir, const char* name, const char* title,
+  Fill fill) {
+  DirectoryGuard guard(dir);
+  TTree* t = new TTree(name, title);
+  fill(t);
+  t->Write("", TObject::kOverwrite);
+  delete t;
+}
+
+// Read tree name from dir: book(t) sets the branch addresses, row() is
+// called after each entry is read and may return false to stop. False if
+// there is no tree or row() stopped.
+template<class Book, class Row>
+inline bool readTable(TDirectory* dir, const char* name, Book book, Row row) {
+  TTree* t = (TTree*) dir->Get(name);
+  if (!t) return false;
+  book(t);
+  bool ok = true;
+  for (Long64_t i = 0; ok && i < t->GetEntries(); ++i) {
+    t->GetEntry(i);
+    ok = row();
+  }
+  delete t;
+  return ok;
+}
+
+//==========================================================================
+
+#endif // MAIN777TABLE_H
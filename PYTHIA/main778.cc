@@ -0,0 +1,255 @@
+// MERGING OF MAIN777 OUTPUTS
+// Author: Stefano Veroni
+// Keywords: ROOT TTREE, ROOT TFILEMERGER
+// Running lines:
+// make main778
+// ./main778 [-j nThreads] merged.root main777tree_1.root main777tree_2.root ...
+// Merges the dis trees and weight histograms of many main777 jobs and
+// writes the combined cross section next to them, the sum of their
+// azimuthal moment tables and one float16 error report. For each input
+// tree file
+// the histogram file of the same job is found by replacing "tree" with
+// "hist" in its name; the histograms go to merged.root with the same
+// replacement (or merged_hist.root when the name has no "tree"). If the
+// jobs wrote a kinematic-bin index ("index" in place of "tree"), one with
+// the same binning is made for the merged tree.
+// Inputs are split into one chunk per thread, each merged on its own, and
+// the chunks merged at the end. Baskets are copied without unzipping as
+// long as all inputs share the compression settings of the first one.
+
+// Run metadata, azimuthal moments, tree index and float16 report of main777
+#include "main777Meta.h"
+#include "main777Moments.h"
+#include "main777Index.h"
+#include "main777Float16.h"
+
+// Generic Packages
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+
+// ROOT functionalities
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+using namespace std;
+
+//============================================================================
+
+// Name of the histogram (kind = "hist") or index file belonging to a
+// tree file.
+string sideName(const string& treeFile, const string& kind = "hist"){
+  size_t i = treeFile.rfind("tree");
+  if (i != string::npos) return string(treeFile).replace(i, 4, kind);
+  size_t dot = treeFile.rfind(".root");
+  return treeFile.substr(0, dot) + "_" + kind + ".root";
+}
+
+// Merge files into out, copying baskets as they are where possible. The
+// combined normalization and float16 report are left out, they are
+// recomputed from those of the jobs.
+bool mergeFiles(const vector<string>& files, const string& out, int compress){
+  TFileMerger merger(kFALSE, kFALSE);
+  merger.SetFastMethod(kTRUE);
+  if (!merger.OutputFile(out.c_str(), "RECREATE", compress)) return false;
+  for (size_t i = 0; i < files.size(); ++i)
+    if (!merger.AddFile(files[i].c_str(), kFALSE)) return false;
+  merger.AddObjectNames("norm");
+  merger.AddObjectNames("float16");
+  return merger.PartialMerge(TFileMerger::kAll | TFileMerger::kRegular
+                             | TFileMerger::kSkipListed);
+}
+
+//============================================================================
+
+int main( int argc, char* argv[] ){
+
+  int nThreads = thread::hardware_concurrency();
+  int iArg = 1;
+  if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+    nThreads = atoi(argv[2]);
+    iArg = 3;
+  }
+  if (argc - iArg < 2) {
+    cout << "Usage: " << argv[0]
+         << " [-j nThreads] merged.root input1.root input2.root ..." << endl;
+    return 1;
+  }
+  string outFile = argv[iArg];
+  vector<string> treeFiles(argv + iArg + 1, argv + argc);
+  if (nThreads < 1) nThreads = 1;
+  if (nThreads > int(treeFiles.size())) nThreads = treeFiles.size();
+
+
+  //==========================================================================
+  // METADATA    METADATA    METADATA    METADATA    METADATA    METADATA
+  //==========================================================================
+  // Read the metadata of every job first: a job without it cannot be
+  // normalized, and it is better to know before merging for an hour.
+  vector<RunMeta> metas;
+  vector<string>  histFiles;
+  Float16Report   f16;
+  bool            f16Same = true;
+  int compress = -1;
+  for (size_t i = 0; i < treeFiles.size(); ++i) {
+    TFile* f = TFile::Open(treeFiles[i].c_str(), "READ");
+    if (!f || f->IsZombie()) {
+      cout << "Error: cannot open " << treeFiles[i] << endl;
+      return 1;
+    }
+    if (compress < 0) compress = f->GetCompressionSettings();
+    else if (f->GetCompressionSettings() != compress)
+      cout << "Warning: " << treeFiles[i] << " has other compression settings,"
+           << " its baskets will be recompressed" << endl;
+    if (!readMeta(f, metas)) {
+      cout << "Error: no run metadata in " << treeFiles[i] << endl;
+      return 1;
+    }
+    Float16Report jobF16;
+    if (jobF16.read(f)) {
+      if (f16.empty()) f16 = jobF16;
+      else if (!f16.add(jobF16)) f16Same = false;
+    }
+    f->Close();
+    delete f;
+    string hist = sideName(treeFiles[i]);
+    if (!gSystem->AccessPathName(hist.c_str())) histFiles.push_back(hist);
+  }
+
+  // Per-job table; the same seed twice means the same events twice.
+  set<int> seeds;
+  cout << "\n Jobs to merge:\n"
+       << "    job        seed     nAccept  sigma (mb)    error (mb)"
+       << "    sum of weights" << endl;
+  for (size_t i = 0; i < metas.size(); ++i) {
+    const RunMeta& m = metas[i];
+    cout << setw(7) << i << setw(12) << m.seed << setw(12) << m.nAccept
+         << scientific << setprecision(4)
+         << setw(14) << m.sigma << setw(14) << m.error
+         << setw(18) << m.sumW << fixed << endl;
+    if (m.seed >= 0 && !seeds.insert(m.seed).second)
+      cout << "Warning: seed " << m.seed << " used by more than one job"
+           << endl;
+  }
+  RunMeta norm = combineMeta(metas);
+
+  // Binning of the index, from the first job that has one.
+  KinIndex index;
+  for (size_t i = 0; i < treeFiles.size() && index.empty(); ++i) {
+    string name = sideName(treeFiles[i], "index");
+    if (gSystem->AccessPathName(name.c_str())) continue;
+    TFile* f = TFile::Open(name.c_str(), "READ");
+    if (f && !f->IsZombie()) index.read(f);
+    if (f) f->Close();
+    delete f;
+  }
+
+
+  //==========================================================================
+  // MERGING    MERGING    MERGING    MERGING    MERGING    MERGING
+  //==========================================================================
+  // One chunk of consecutive inputs per thread, then the chunks together.
+  ROOT::EnableThreadSafety();
+  string histOut = sideName(outFile);
+  vector<string> treeParts, histParts;
+  vector<thread> workers;
+  vector<int>    ok(nThreads, 1);
+  for (int it = 0; it < nThreads; ++it) {
+    treeParts.push_back(outFile + ".part" + to_string(it));
+    histParts.push_back(histOut + ".part" + to_string(it));
+  }
+  for (int it = 0; it < nThreads; ++it)
+    workers.push_back(thread([&, it]() {
+      size_t nTree = treeFiles.size(), nHist = histFiles.size();
+      vector<string> trees(treeFiles.begin() + it * nTree / nThreads,
+                           treeFiles.begin() + (it + 1) * nTree / nThreads);
+      vector<string> hists(histFiles.begin() + it * nHist / nThreads,
+                           histFiles.begin() + (it + 1) * nHist / nThreads);
+      ok[it] = mergeFiles(trees, treeParts[it], compress)
+        && (hists.empty() || mergeFiles(hists, histParts[it], compress));
+      if (hists.empty()) histParts[it] = "";
+    }));
+  for (int it = 0; it < nThreads; ++it) workers[it].join();
+  for (int it = 0; it < nThreads; ++it) if (!ok[it]) {
+    cout << "Error: merging chunk " << it << " failed" << endl;
+    return 1;
+  }
+
+  if (!histFiles.empty()) {
+    vector<string> parts;
+    for (int it = 0; it < nThreads; ++it)
+      if (histParts[it] != "") parts.push_back(histParts[it]);
+    if (!mergeFiles(parts, histOut, compress)) {
+      cout << "Error: merging " << histOut << " failed" << endl;
+      return 1;
+    }
+  }
+  if (!mergeFiles(treeParts, outFile, compress)) {
+    cout << "Error: merging " << outFile << " failed" << endl;
+    return 1;
+  }
+  for (int it = 0; it < nThreads; ++it) {
+    remove(treeParts[it].c_str());
+    if (histParts[it] != "") remove(histParts[it].c_str());
+  }
+
+  // The chunks merged the per-job meta entries into one table; add the
+  // combined normalization and float16 report. The moment tables of the
+  // jobs were appended to each other as well, they are summed bin by bin.
+  TFile* f = TFile::Open(outFile.c_str(), "UPDATE");
+  if (!f || f->IsZombie()) {
+    cout << "Error: cannot reopen " << outFile << endl;
+    return 1;
+  }
+  writeMeta(f, norm, "norm");
+  if (!f16.empty()) {
+    f16.print();
+    f16.write(f);
+    if (!f16Same) cout << "Warning: jobs with different float16 branches,"
+                       << " only those of the first job combined" << endl;
+  }
+  MomentAccumulator moments;
+  if (moments.read(f)) moments.write(f);
+  else if (!moments.empty())
+    cout << "Error: jobs with different moment binnings, moments not summed"
+         << endl;
+
+  // The entry numbers change with merging, so the index is made anew.
+  string indexOut = sideName(outFile, "index");
+  TTree* tree = (TTree*) f->Get("dis");
+  if (!index.empty() && tree) {
+    TFile* fi = TFile::Open(indexOut.c_str(), "RECREATE");
+    if (fi && !fi->IsZombie() && index.build(tree)) index.write(fi);
+    else {
+      cout << "Warning: cannot write " << indexOut << endl;
+      index = KinIndex();
+    }
+    if (fi) fi->Close();
+    delete fi;
+  }
+  else index = KinIndex();
+  f->Close();
+  delete f;
+
+  cout << scientific << setprecision(6)
+       << "\n Merged " << metas.size() << " jobs into " << outFile
+       << (histFiles.empty() ? "" : " and " + histOut)
+       << (index.empty() ? "" : ", index " + indexOut) << "\n"
+       << "\t Accepted events           = " << norm.nAccept << "\n"
+       << "\t Cross section             = " << norm.sigma
+       << " +- " << norm.error << " mb\n"
+       << "\t Sum of weights            = " << norm.sumW << "\n"
+       << "\t Event normalization       = sigma * wt / sumW = "
+       << norm.sigma / norm.sumW << " * wt mb" << endl;
+
+  return 0;
+}